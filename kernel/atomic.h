@@ -30,6 +30,26 @@ inline void iAmStuckInALoop(bool use_mwait) {
 }
 
 
+// Memory orders for the atomic operations. Everything defaults to
+// SEQ_CST; ask for less where it's safe:
+//    RELAXED  counters nobody synchronizes on (e.g. taking a reference)
+//    ACQUIRE  loads/RMWs that take something (a lock, the last reference)
+//    RELEASE  stores that publish something (an unlock)
+// On x86 this mostly matters for plain stores: a SEQ_CST store needs a
+// fence (xchg) while a RELEASE store is a mov.
+enum MemoryOrder : int {
+    RELAXED = __ATOMIC_RELAXED,
+    ACQUIRE = __ATOMIC_ACQUIRE,
+    RELEASE = __ATOMIC_RELEASE,
+    ACQ_REL = __ATOMIC_ACQ_REL,
+    SEQ_CST = __ATOMIC_SEQ_CST
+};
+
+// a failed compare_exchange is a load, it can't have release semantics
+constexpr int failureOrder(MemoryOrder order) {
+    return (order == RELEASE) ? RELAXED : (order == ACQ_REL) ? ACQUIRE : order;
+}
+
 template <typename T>
 class AtomicPtr {
     volatile T *ptr;
@@ -43,23 +63,28 @@ public:
     operator T () const {
         return __atomic_load_n(ptr,__ATOMIC_SEQ_CST);
     }
-    T fetch_add(T inc) {
-        return __atomic_fetch_add(ptr,inc,__ATOMIC_SEQ_CST);
+    T fetch_add(T inc, MemoryOrder order = SEQ_CST) {
+        return __atomic_fetch_add(ptr,inc,order);
     }
-    T add_fetch(T inc) {
-        return __atomic_add_fetch(ptr,inc,__ATOMIC_SEQ_CST);
+    T add_fetch(T inc, MemoryOrder order = SEQ_CST) {
+        return __atomic_add_fetch(ptr,inc,order);
     }
-    void set(T inc) {
-        return __atomic_store_n(ptr,inc,__ATOMIC_SEQ_CST);
+    void set(T inc, MemoryOrder order = SEQ_CST) {
+        return __atomic_store_n(ptr,inc,order);
     }
-    T get(void) {
-        return __atomic_load_n(ptr,__ATOMIC_SEQ_CST);
+    T get(MemoryOrder order = SEQ_CST) {
+        return __atomic_load_n(ptr,order);
     }
-    T exchange(T v) {
+    T exchange(T v, MemoryOrder order = SEQ_CST) {
         T ret;
-        __atomic_exchange(ptr,&v,&ret,__ATOMIC_SEQ_CST);
+        __atomic_exchange(ptr,&v,&ret,order);
         return ret;
     }
+    // true if it was "expected" (and is now "desired"), otherwise
+    // "expected" gets the current value
+    bool compare_exchange(T& expected, T desired, MemoryOrder order = SEQ_CST) {
+        return __atomic_compare_exchange_n(ptr,&expected,desired,false,order,failureOrder(order));
+    }
 };
 
 template <typename T>
@@ -74,40 +99,106 @@ public:
     operator T () const {
         return __atomic_load_n(&value,__ATOMIC_SEQ_CST);
     }
-    T fetch_add(T inc) {
-        return __atomic_fetch_add(&value,inc,__ATOMIC_SEQ_CST);
+    T fetch_add(T inc, MemoryOrder order = SEQ_CST) {
+        return __atomic_fetch_add(&value,inc,order);
     }
-    T add_fetch(T inc) {
-        return __atomic_add_fetch(&value,inc,__ATOMIC_SEQ_CST);
+    T add_fetch(T inc, MemoryOrder order = SEQ_CST) {
+        return __atomic_add_fetch(&value,inc,order);
     }
-    void set(T inc) {
-        return __atomic_store_n(&value,inc,__ATOMIC_SEQ_CST);
+    void set(T inc, MemoryOrder order = SEQ_CST) {
+        return __atomic_store_n(&value,inc,order);
     }
-    T get(void) {
-        return __atomic_load_n(&value,__ATOMIC_SEQ_CST);
+    T get(MemoryOrder order = SEQ_CST) {
+        return __atomic_load_n(&value,order);
     }
-    T exchange(T v) {
+    T exchange(T v, MemoryOrder order = SEQ_CST) {
         T ret;
-        __atomic_exchange(&value,&v,&ret,__ATOMIC_SEQ_CST);
+        __atomic_exchange(&value,&v,&ret,order);
         return ret;
     }
+    // true if it was "expected" (and is now "desired"), otherwise
+    // "expected" gets the current value
+    bool compare_exchange(T& expected, T desired, MemoryOrder order = SEQ_CST) {
+        return __atomic_compare_exchange_n(&value,&expected,desired,false,order,failureOrder(order));
+    }
+    void monitor_value() {
+        monitor((uintptr_t)&value);
+    }
+};
+
+// 64 bit atomics on a 32 bit machine: everything goes through cmpxchg8b,
+// which is a full barrier, so the memory orders are accepted and ignored
+template <typename T>
+class Atomic64 {
+    volatile T value __attribute__((aligned(8)));
+
+    // returns the old value, stores "desired" if it was "expected"
+    static T cas(volatile T* p, T expected, T desired) {
+        T prev;
+        asm volatile("lock cmpxchg8b %1"
+            : "=A"(prev), "+m"(*p)
+            : "b"((uint32_t) desired), "c"((uint32_t) (((uint64_t) desired) >> 32)), "0"(expected)
+            : "memory", "cc");
+        return prev;
+    }
+
+    template <typename F>
+    T update(F f) {
+        T old = get();
+        while (true) {
+            T prev = cas(&value, old, f(old));
+            if (prev == old) return old;
+            old = prev;
+        }
+    }
+public:
+    Atomic64(T x) : value(x) {}
+    Atomic64<T>& operator= (T v) {
+        set(v);
+        return *this;
+    }
+    operator T () const {
+        // a compare and swap that never changes anything
+        return cas(const_cast<volatile T*>(&value), 0, 0);
+    }
+    T fetch_add(T inc, MemoryOrder = SEQ_CST) {
+        return update([inc](T v) { return v + inc; });
+    }
+    T add_fetch(T inc, MemoryOrder = SEQ_CST) {
+        return fetch_add(inc) + inc;
+    }
+    void set(T v, MemoryOrder = SEQ_CST) {
+        update([v](T) { return v; });
+    }
+    T get(MemoryOrder = SEQ_CST) {
+        return cas(&value, 0, 0);
+    }
+    T exchange(T v, MemoryOrder = SEQ_CST) {
+        return update([v](T) { return v; });
+    }
+    bool compare_exchange(T& expected, T desired, MemoryOrder = SEQ_CST) {
+        T prev = cas(&value, expected, desired);
+        if (prev == expected) return true;
+        expected = prev;
+        return false;
+    }
     void monitor_value() {
         monitor((uintptr_t)&value);
     }
 };
 
 template <>
-class Atomic<uint64_t> {
+class Atomic<uint64_t> : public Atomic64<uint64_t> {
 public:
-    Atomic() = delete;
-    Atomic(uint64_t) = delete;
+    using Atomic64<uint64_t>::Atomic64;
+    using Atomic64<uint64_t>::operator=;
 };
 
 template <>
-class Atomic<int64_t> {
+class Atomic<int64_t> : public Atomic64<int64_t> {
 public:
-    Atomic() = delete;
-    Atomic(int64_t) = delete;
+    using Atomic64<int64_t>::Atomic64;
+    using Atomic64<int64_t>::operator=;
 };
 
 class Interrupts {
@@ -171,69 +262,293 @@ public:
 
 extern void pause();
 
-class SpinLock {
+// Lock profiling (make KFLAGS=-DLOCK_PROFILE ...)
+//
+// Every lock records its acquisitions, how many of them had to wait, how
+// long they waited (spin cycles) and how long the lock was held, keyed
+// by lock and by acquisition site. The report comes out at shutdown, the
+// sites are code addresses (addr2line -e build/kernel.kernel).
+//
+// A lock reports through the LOCK_PROFILE_* macros, they compile to
+// nothing in a normal build.
+
+#ifdef LOCK_PROFILE
+
+namespace LockProfile {
+    // who got the lock and when, kept in the lock itself
+    struct Hold {
+        uint64_t since = 0;
+        void* site = nullptr;
+    };
+
+    // Not inlined: the return address is the acquisition site
+    extern void __attribute__((noinline)) acquired(const void* lock, Hold& hold, uint64_t start, bool contended);
+    extern void released(const void* lock, Hold& hold);
+    extern void report();
+}
+
+#define LOCK_PROFILE_STATE      LockProfile::Hold profile_hold;
+#define LOCK_PROFILE_BEGIN      const uint64_t profile_start = rdtsc(); bool profile_contended = false;
+#define LOCK_PROFILE_CONTENDED  profile_contended = true;
+#define LOCK_PROFILE_ACQUIRED   LockProfile::acquired(this, profile_hold, profile_start, profile_contended);
+#define LOCK_PROFILE_RELEASE    LockProfile::released(this, profile_hold);
+#define LOCK_PROFILE_INLINE     __attribute__((always_inline)) inline
+
+#else
+
+#define LOCK_PROFILE_STATE
+#define LOCK_PROFILE_BEGIN
+#define LOCK_PROFILE_CONTENDED
+#define LOCK_PROFILE_ACQUIRED
+#define LOCK_PROFILE_RELEASE
+#define LOCK_PROFILE_INLINE     inline
+
+#endif
+
+// Spin locks
+//
+//    TASLock     test-and-set, everybody spins on the same word. Cheap
+//                when uncontended but unfair and the cache line bounces
+//                between all the waiters
+//    TicketLock  FIFO, waiters spin on "serving" and only read it
+//    MCSLock     FIFO, every waiter spins on its own queue node so a
+//                release touches a single remote cache line
+//
+// They all have the same interface; pick one per lock. SpinLock is the
+// test-and-set lock. None of these disable interrupts, wrap them in
+// InterruptSafe<> for that. A queued waiter can't give up its place, so
+// don't let it get preempted while it waits (InterruptSafe<> takes care
+// of it).
+
+class TASLock {
     Atomic<bool> taken;
+    LOCK_PROFILE_STATE
 public:
-    SpinLock() : taken(false) {}
+    TASLock() : taken(false) {}
 
-    SpinLock(const SpinLock&) = delete;
+    TASLock(const TASLock&) = delete;
 
     // for debugging, etc. Allows false positives
     bool isMine() {
         return taken.get();
     }
 
-    void lock(void) {
+    LOCK_PROFILE_INLINE void lock(void) {
+        LOCK_PROFILE_BEGIN
         taken.monitor_value();
-        while (taken.exchange(true)) {
+        while (taken.exchange(true, ACQUIRE)) {
+            LOCK_PROFILE_CONTENDED
             iAmStuckInALoop(true);
             taken.monitor_value();
         }
+        LOCK_PROFILE_ACQUIRED
     }
     
     void unlock(void) {
-        taken.set(false);
+        LOCK_PROFILE_RELEASE
+        taken.set(false, RELEASE);
     }
 };
 
+using SpinLock = TASLock;
+
+class TicketLock {
+    Atomic<uint32_t> next;
+    Atomic<uint32_t> serving;
+    LOCK_PROFILE_STATE
+public:
+    TicketLock() : next(0), serving(0) {}
+
+    TicketLock(const TicketLock&) = delete;
+
+    // for debugging, etc. Allows false positives
+    bool isMine() {
+        return next.get() != serving.get();
+    }
+
+    LOCK_PROFILE_INLINE void lock(void) {
+        LOCK_PROFILE_BEGIN
+        uint32_t ticket = next.fetch_add(1, RELAXED);
+        while (true) {
+            serving.monitor_value();
+            if (serving.get(ACQUIRE) == ticket) break;
+            LOCK_PROFILE_CONTENDED
+            iAmStuckInALoop(true);
+        }
+        LOCK_PROFILE_ACQUIRED
+    }
+
+    void unlock(void) {
+        LOCK_PROFILE_RELEASE
+        // only the holder writes "serving"
+        serving.set(serving.get(RELAXED) + 1, RELEASE);
+    }
+};
+
+// The K42 variant of MCS: the queue node lives on the waiter's stack while
+// it waits and the holder's spot in the queue is taken over by the lock
+// itself, so lock() and unlock() don't need an extra argument.
+class MCSLock {
+    struct Node {
+        Node* volatile next;
+        volatile bool waiting;
+    };
+
+    Node holder;               // holder.next is the first waiter
+    Node* volatile tail;       // nullptr => free, &holder => no waiters
+    LOCK_PROFILE_STATE
+
+    static Node* cas(Node* volatile* where, Node* expected, Node* desired) {
+        __atomic_compare_exchange_n(where, &expected, desired, false,
+            __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+        return expected;
+    }
+
+    // spin until "*where" is not nullptr
+    static Node* waitFor(Node* volatile* where) {
+        while (true) {
+            monitor((uintptr_t)where);
+            Node* it = __atomic_load_n(where, __ATOMIC_SEQ_CST);
+            if (it != nullptr) return it;
+            iAmStuckInALoop(true);
+        }
+    }
+
+public:
+    MCSLock() : holder{nullptr, false}, tail(nullptr) {}
+
+    MCSLock(const MCSLock&) = delete;
+
+    // for debugging, etc. Allows false positives
+    bool isMine() {
+        return tail != nullptr;
+    }
+
+    LOCK_PROFILE_INLINE void lock(void) {
+        LOCK_PROFILE_BEGIN
+        while (true) {
+            Node* prev = tail;
+            if (prev == nullptr) {
+                if (cas(&tail, nullptr, &holder) == nullptr) break;
+                continue;
+            }
+            LOCK_PROFILE_CONTENDED
+            Node me{nullptr, true};
+            if (cas(&tail, prev, &me) != prev) continue;
+
+            prev->next = &me;
+            while (true) {
+                monitor((uintptr_t)&me.waiting);
+                if (!__atomic_load_n(&me.waiting, __ATOMIC_ACQUIRE)) break;
+                iAmStuckInALoop(true);
+            }
+
+            // we own the lock, move our successor to the lock before
+            // "me" goes out of scope
+            Node* succ = me.next;
+            if (succ == nullptr) {
+                holder.next = nullptr;
+                if (cas(&tail, &me, &holder) != &me) {
+                    // somebody is linking in behind us
+                    holder.next = waitFor(&me.next);
+                }
+            } else {
+                holder.next = succ;
+            }
+            break;
+        }
+        LOCK_PROFILE_ACQUIRED
+    }
+
+    void unlock(void) {
+        LOCK_PROFILE_RELEASE
+        Node* succ = holder.next;
+        if (succ == nullptr) {
+            if (cas(&tail, &holder, nullptr) == &holder) return;
+            succ = waitFor(&holder.next);
+        }
+        holder.next = nullptr;
+        __atomic_store_n(&succ->waiting, false, __ATOMIC_RELEASE);
+    }
+};
+
+// Disables interrupts while the lock is held (and while we wait for it)
+template <typename Raw>
+class InterruptSafe {
+    Raw raw;
+    volatile bool was;
+public:
+    Atomic<uint32_t> ref_count;
+    InterruptSafe() : raw(), was(false), ref_count(0) {}
+
+    InterruptSafe(const InterruptSafe&) = delete;
+
+    // for debugging, etc. Allows false positives
+    bool isMine() {
+        return raw.isMine();
+    }
+
+    LOCK_PROFILE_INLINE void lock() {
+        bool wasDisabled = Interrupts::disable();
+        raw.lock();
+        was = wasDisabled;
+    }
+
+    void unlock() {
+        auto wasDisabled = was;
+        raw.unlock();
+        Interrupts::restore(wasDisabled);
+    }
+};
+
+// The test-and-set flavor can back off with interrupts enabled
 // Is this correct? 
-class InterruptSafeLock  {
+template <>
+class InterruptSafe<TASLock>  {
     Atomic<bool> taken;
     volatile bool was;
+    LOCK_PROFILE_STATE
 public:    
     Atomic<uint32_t> ref_count;
-    InterruptSafeLock() : taken(false), was(false), ref_count(0) {}
+    InterruptSafe() : taken(false), was(false), ref_count(0) {}
 
-    InterruptSafeLock(const InterruptSafeLock&) = delete;
+    InterruptSafe(const InterruptSafe&) = delete;
 
     // for debugging, etc. Allows false positives
     bool isMine() {
         return taken.get();
     }
 
-    void lock() {
+    LOCK_PROFILE_INLINE void lock() {
+        LOCK_PROFILE_BEGIN
         while (true) {
             taken.monitor_value();
             bool wasDisabled = Interrupts::disable();           
-            if (!taken.exchange(true)) {
+            if (!taken.exchange(true, ACQUIRE)) {
                 was = wasDisabled;
+                LOCK_PROFILE_ACQUIRED
                 return;
             }
+            LOCK_PROFILE_CONTENDED
             Interrupts::restore(wasDisabled);
             iAmStuckInALoop(true);
         }
     }
 
     void unlock() {
+        LOCK_PROFILE_RELEASE
         auto wasDisabled = was;
-        taken.set(false);
+        taken.set(false, RELEASE);
         Interrupts::restore(wasDisabled);
     }
 };
 
+using InterruptSafeLock = InterruptSafe<TASLock>;
+
 // A more flexible InterruptSafeLock
 class ISL  {
     Atomic<bool> taken;
+    LOCK_PROFILE_STATE
 public:    
     Atomic<uint32_t> ref_count;
     ISL() : taken(false), ref_count(0) {}
@@ -247,20 +562,24 @@ public:
         return taken.get();
     }
 
-    bool lock() {
+    LOCK_PROFILE_INLINE bool lock() {
+        LOCK_PROFILE_BEGIN
         while (true) {
             taken.monitor_value();
             bool wasDisabled = Interrupts::disable();           
-            if (!taken.exchange(true)) {
+            if (!taken.exchange(true, ACQUIRE)) {
+                LOCK_PROFILE_ACQUIRED
                 return wasDisabled;
             }
+            LOCK_PROFILE_CONTENDED
             Interrupts::restore(wasDisabled);
             iAmStuckInALoop(true);
         }
     }
 
     void unlock(bool disable) {
-        taken.set(false);
+        LOCK_PROFILE_RELEASE
+        taken.set(false, RELEASE);
         if (disable) {
             cli();
         } else {
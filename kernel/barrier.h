@@ -60,6 +60,169 @@ public:
 	    sem.up();
     }
 };
-        
+
+namespace gheith {
+
+    // Where barrier waiters sit: they spin for a while (the others are
+    // probably about to show up) then park until the generation changes
+    class BarrierGate {
+        Atomic<uint32_t> generation;
+        Atomic<uint32_t> nParked;
+        InterruptSafeLock lock;
+        Queue<TCB,NoLock> parked;
+
+        static constexpr uint32_t SPIN_LIMIT = 10000;
+    public:
+        BarrierGate() : generation(0), nParked(0), lock(), parked() {}
+        BarrierGate(const BarrierGate&) = delete;
+
+        // the generation a newcomer waits out
+        uint32_t enter() {
+            return generation.get();
+        }
+
+        // wait for the generation to move past "gen"
+        void wait(uint32_t gen) {
+            for (uint32_t i = 0; i < SPIN_LIMIT; i++) {
+                if (generation.get() != gen) return;
+                iAmStuckInALoop(false);
+            }
+            if (current()->isIdle) {
+                while (generation.get() == gen) iAmStuckInALoop(false);
+                return;
+            }
+            block(BlockOption::MustBlock, [this, gen](TCB* me) {
+                LockGuard g{lock};
+                nParked.add_fetch(1);
+                if (generation.get() != gen) {
+                    nParked.add_fetch(-1);
+                    schedule(me);
+                } else {
+                    parked.add(me);
+                }
+            });
+        }
+
+        // let everybody waiting for this generation go
+        void open() {
+            // a locked RMW, so the load of nParked can't move ahead of it.
+            // Pairs with a waiter counting itself before it looks
+            generation.add_fetch(1);
+            if (nParked.get() == 0) return;
+            LockGuard g{lock};
+            while (true) {
+                auto it = parked.remove();
+                if (it == nullptr) break;
+                nParked.add_fetch(-1);
+                schedule(it);
+            }
+        }
+    };
+}
+
+// A reusable barrier with no locks on the fast path. The last one to
+// show up resets the count and opens the gate (flips the "sense")
+class SenseBarrier : public Sharable<SenseBarrier> {
+    const uint32_t n;
+    Atomic<uint32_t> count;
+    gheith::BarrierGate gate;
+public:
+    SenseBarrier(uint32_t n) : n(n), count(n), gate() {}
+    SenseBarrier(const SenseBarrier&) = delete;
+    SenseBarrier& operator=(const SenseBarrier&) const = delete;
+
+    void sync() {
+        // can't move until we show up, read it first
+        auto gen = gate.enter();
+        if (count.add_fetch(-1) == 0) {
+            count.set(n);
+            gate.open();
+        } else {
+            gate.wait(gen);
+        }
+    }
+};
+
+// A reusable combining tree barrier. Participants (ids 0..n-1) arrive at
+// a leaf shared with FAN_IN-1 others, the last one to arrive at a node
+// moves up to its parent and the last one at the root opens the gate.
+// Each counter only sees FAN_IN arrivals, so the traffic on any cache
+// line doesn't grow with n
+class TreeBarrier : public Sharable<TreeBarrier> {
+    static constexpr uint32_t FAN_IN = 4;
+
+    struct Node {
+        Atomic<uint32_t> count{0};
+        uint32_t expected = 0;
+        Node* parent = nullptr;
+        char pad[52];                  // one cache line each
+    };
+
+    const uint32_t n;
+    uint32_t nLeaves;
+    Node* nodes;
+    gheith::BarrierGate gate;
+public:
+    TreeBarrier(uint32_t n) : n(n), nodes(nullptr), gate() {
+        ASSERT(n > 0);
+        // count the nodes, level by level
+        uint32_t total = 0;
+        uint32_t width = n;
+        do {
+            width = (width + FAN_IN - 1) / FAN_IN;
+            total += width;
+        } while (width > 1);
+
+        nodes = new Node[total];
+        nLeaves = (n + FAN_IN - 1) / FAN_IN;
+
+        // level by level: "below" things feed into "width" nodes
+        uint32_t first = 0;
+        uint32_t below = n;
+        width = nLeaves;
+        while (true) {
+            for (uint32_t i = 0; i < below; i++) {
+                nodes[first + i / FAN_IN].expected ++;
+            }
+            for (uint32_t i = 0; i < width; i++) {
+                nodes[first + i].count.set(nodes[first + i].expected);
+            }
+            if (width == 1) break;
+            uint32_t next = first + width;
+            uint32_t up = (width + FAN_IN - 1) / FAN_IN;
+            for (uint32_t i = 0; i < width; i++) {
+                nodes[first + i].parent = &nodes[next + i / FAN_IN];
+            }
+            below = width;
+            first = next;
+            width = up;
+        }
+    }
+
+    ~TreeBarrier() {
+        delete[] nodes;
+    }
+
+    TreeBarrier(const TreeBarrier&) = delete;
+    TreeBarrier& operator=(const TreeBarrier&) const = delete;
+
+    void sync(uint32_t id) {
+        ASSERT(id < n);
+        auto gen = gate.enter();
+        Node* node = &nodes[id / FAN_IN];
+        while (true) {
+            if (node->count.add_fetch(-1) != 0) {
+                gate.wait(gen);
+                return;
+            }
+            // last one here, reset it for next time and move up
+            node->count.set(node->expected);
+            if (node->parent == nullptr) break;
+            node = node->parent;
+        }
+        gate.open();
+    }
+};
+
 #endif
 
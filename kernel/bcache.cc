@@ -0,0 +1,382 @@
+#include "bcache.h"
+#include "blocking_lock.h"
+#include "debug.h"
+#include "libk.h"
+#include "machine.h"
+
+namespace BufferCache {
+
+    // The cache is split in shards by hash, each with its own lock, hash
+    // table, CLOCK ring and slice of the budget. Threads working on
+    // different blocks rarely touch the same shard
+    constexpr uint32_t SHARD_BITS = 4;
+    constexpr uint32_t SHARDS = 1 << SHARD_BITS;
+    constexpr uint32_t BUCKET_BITS = 6;
+    constexpr uint32_t BUCKETS = 1 << BUCKET_BITS;      // per shard
+
+    struct Entry {
+        Shared<Buffer> buffer;         // the cache's own reference
+        Entry* hashNext = nullptr;
+        Entry* clockNext = nullptr;    // the CLOCK ring is circular
+        Entry* clockPrev = nullptr;
+        bool referenced = true;        // hit since the hand last came by
+        bool prefetched = false;       // brought in by prefetch(), nobody asked for it yet
+
+        Entry(Shared<Buffer> buffer) : buffer(K::move(buffer)) {}
+    };
+
+    struct Shard {
+        BlockingLock lock{};
+        Entry* buckets[BUCKETS] {};
+        Entry* hand = nullptr;
+        uint32_t nEntries = 0;
+        Stats counts { 0, 0, 0, 0, DEFAULT_BUDGET / SHARDS, 0, 0, 0, 0, 0 };
+        char pad[60];                  // keep the shards' hot fields apart
+
+        Entry*& bucket(uint32_t h) {
+            return buckets[(h >> (32 - SHARD_BITS - BUCKET_BITS)) & (BUCKETS - 1)];
+        }
+
+        Entry* find(uint32_t h, Ide* device, uint32_t number, uint32_t size);
+        void insert(uint32_t h, Entry* e);
+        void unlink(uint32_t h, Entry* e);
+        Entry* shrink();
+    };
+
+    static Shard shards[SHARDS];
+
+    static Atomic<uint32_t> nDirty{0};
+    static Atomic<uint32_t> dirtyBytes{0};
+    static Atomic<uint32_t> nWritten{0};
+    static BlockingLock syncLock{};
+
+    static inline uint32_t hash(Ide* device, uint32_t number) {
+        return (number ^ ((uint32_t) device >> 4)) * 0x9E3779B1;
+    }
+
+    static inline Shard& shard(uint32_t h) {
+        return shards[h >> (32 - SHARD_BITS)];
+    }
+
+    // All of these are called with the shard's lock held
+
+    Entry* Shard::find(uint32_t h, Ide* device, uint32_t number, uint32_t size) {
+        for (auto e = bucket(h); e != nullptr; e = e->hashNext) {
+            auto& b = e->buffer;
+            if (b->number == number && b->device == device && b->size == size) return e;
+        }
+        return nullptr;
+    }
+
+    void Shard::insert(uint32_t h, Entry* e) {
+        auto& head = bucket(h);
+        e->hashNext = head;
+        head = e;
+
+        // just behind the hand, it's the last one the hand will look at
+        if (hand == nullptr) {
+            e->clockNext = e;
+            e->clockPrev = e;
+            hand = e;
+        } else {
+            e->clockNext = hand;
+            e->clockPrev = hand->clockPrev;
+            hand->clockPrev->clockNext = e;
+            hand->clockPrev = e;
+        }
+        nEntries ++;
+        counts.bytes += e->buffer->size;
+    }
+
+    void Shard::unlink(uint32_t h, Entry* e) {
+        for (auto p = &bucket(h); *p != nullptr; p = &(*p)->hashNext) {
+            if (*p == e) {
+                *p = e->hashNext;
+                break;
+            }
+        }
+
+        if (e->clockNext == e) {
+            hand = nullptr;
+        } else {
+            e->clockPrev->clockNext = e->clockNext;
+            e->clockNext->clockPrev = e->clockPrev;
+            if (hand == e) hand = e->clockNext;
+        }
+        nEntries --;
+        counts.bytes -= e->buffer->size;
+    }
+
+    // Returns the evicted entries (linked through hashNext), the caller
+    // frees them after letting go of the lock
+    Entry* Shard::shrink() {
+        Entry* victims = nullptr;
+        // two trips around the ring: one to clear the bits, one to evict
+        uint32_t togo = 2 * nEntries;
+        while (counts.bytes > counts.budget && hand != nullptr && togo > 0) {
+            togo --;
+            auto e = hand;
+            hand = e->clockNext;
+            // nobody else can get a new reference while we hold the lock
+            if (e->buffer.use_count() != 1) continue;
+            // only sync() can make it clean
+            if (e->buffer->dirty) continue;
+            if (e->referenced) {
+                e->referenced = false;
+                continue;
+            }
+            unlink(hash(e->buffer->device, e->buffer->number), e);
+            counts.evictions ++;
+            if (e->prefetched) counts.prefetch_waste ++;
+            e->hashNext = victims;
+            victims = e;
+        }
+        return victims;
+    }
+
+    static void release(Entry* victims) {
+        while (victims != nullptr) {
+            auto next = victims->hashNext;
+            delete victims;
+            victims = next;
+        }
+    }
+
+    // called with the lock held
+    static void hit(Shard& s, Entry* e) {
+        e->referenced = true;
+        if (e->prefetched) {
+            e->prefetched = false;
+            s.counts.prefetch_hits ++;
+        }
+    }
+
+    // Reads the block and adds it, unless somebody beat us to it
+    static Shared<Buffer> fill(uint32_t h, Ide* device, uint32_t number, uint32_t size, bool prefetch) {
+        auto fresh = Shared<Buffer>::make(device, number, size);
+        auto cnt = device->read_all(number * size, size, fresh->data);
+        ASSERT(cnt == size);
+
+        auto& s = shard(h);
+        Entry* victims = nullptr;
+        {
+            LockGuard g{s.lock};
+            auto e = s.find(h, device, number, size);
+            if (e != nullptr) {
+                if (!prefetch) hit(s, e);
+                fresh = e->buffer;
+            } else {
+                e = new Entry(fresh);
+                e->prefetched = prefetch;
+                // it has to earn its second chance
+                e->referenced = !prefetch;
+                if (prefetch) s.counts.prefetched ++;
+                s.insert(h, e);
+                victims = s.shrink();
+            }
+        }
+        release(victims);
+        return fresh;
+    }
+
+    Shared<Buffer> get(Borrowed<Ide> device, uint32_t number, uint32_t size) {
+        Ide* dev = device.operator->();
+        uint32_t h = hash(dev, number);
+        auto& s = shard(h);
+        {
+            LockGuard g{s.lock};
+            auto e = s.find(h, dev, number, size);
+            if (e != nullptr) {
+                s.counts.hits ++;
+                hit(s, e);
+                return e->buffer;
+            }
+            s.counts.misses ++;
+        }
+        return fill(h, dev, number, size, false);
+    }
+
+    Shared<Buffer> lookup(Borrowed<Ide> device, uint32_t number, uint32_t size) {
+        Ide* dev = device.operator->();
+        uint32_t h = hash(dev, number);
+        auto& s = shard(h);
+        LockGuard g{s.lock};
+        auto e = s.find(h, dev, number, size);
+        if (e == nullptr) {
+            // the caller goes to the disk itself
+            s.counts.misses ++;
+            return Shared<Buffer>{};
+        }
+        s.counts.hits ++;
+        hit(s, e);
+        return e->buffer;
+    }
+
+    void prefetch(Borrowed<Ide> device, uint32_t number, uint32_t size) {
+        Ide* dev = device.operator->();
+        uint32_t h = hash(dev, number);
+        auto& s = shard(h);
+        {
+            LockGuard g{s.lock};
+            if (s.find(h, dev, number, size) != nullptr) return;
+        }
+        fill(h, dev, number, size, true);
+    }
+
+    void mark_dirty(Borrowed<Buffer> buffer) {
+        auto b = buffer.operator->();
+        if (!__atomic_exchange_n(&b->dirty, true, __ATOMIC_SEQ_CST)) {
+            nDirty.add_fetch(1);
+            dirtyBytes.add_fetch(b->size);
+        }
+    }
+
+    static void mark_clean(Buffer* b) {
+        if (__atomic_exchange_n(&b->dirty, false, __ATOMIC_SEQ_CST)) {
+            nDirty.add_fetch(-1);
+            dirtyBytes.add_fetch(-b->size);
+        }
+    }
+
+    uint32_t dirty_bytes() {
+        return dirtyBytes.get();
+    }
+
+    Shared<Buffer> create(Borrowed<Ide> device, uint32_t number, uint32_t size) {
+        Ide* dev = device.operator->();
+        uint32_t h = hash(dev, number);
+        auto& s = shard(h);
+        Shared<Buffer> out;
+        Entry* victims = nullptr;
+        {
+            LockGuard g{s.lock};
+            auto e = s.find(h, dev, number, size);
+            if (e == nullptr) {
+                e = new Entry(Shared<Buffer>::make(dev, number, size));
+                s.insert(h, e);
+                victims = s.shrink();
+            }
+            // left over from before the block was freed, nobody wants it
+            bzero(e->buffer->data, size);
+            hit(s, e);
+            out = e->buffer;
+        }
+        release(victims);
+        mark_dirty(out);
+        return out;
+    }
+
+    static inline bool before(Buffer* a, Buffer* b) {
+        if (a->device != b->device) return a->device < b->device;
+        return a->number < b->number;
+    }
+
+    // Shell sort, no recursion and no temporaries
+    static void sort(Buffer** a, uint32_t n) {
+        uint32_t gap = 1;
+        while (gap < n / 3) gap = 3 * gap + 1;
+        for (; gap > 0; gap /= 3) {
+            for (uint32_t i = gap; i < n; i++) {
+                auto x = a[i];
+                uint32_t j = i;
+                for (; j >= gap && before(x, a[j - gap]); j -= gap) {
+                    a[j] = a[j - gap];
+                }
+                a[j] = x;
+            }
+        }
+    }
+
+    constexpr uint32_t MAX_RUN = 64 * 1024;     // bytes in one write command
+
+    void sync() {
+        LockGuard sg{syncLock};
+
+        // Hold on to every dirty buffer. Blocks that get dirty after we
+        // looked at their shard wait for the next sync()
+        uint32_t n = 0;
+        uint32_t capacity = nDirty.get() + 16;
+        auto held = new Shared<Buffer>[capacity];
+        auto order = new Buffer*[capacity];
+        for (uint32_t i = 0; i < SHARDS && n < capacity; i++) {
+            auto& s = shards[i];
+            LockGuard g{s.lock};
+            auto e = s.hand;
+            for (uint32_t k = 0; k < s.nEntries && n < capacity; k++, e = e->clockNext) {
+                if (!e->buffer->dirty) continue;
+                held[n] = e->buffer;
+                order[n] = e->buffer.operator->();
+                n++;
+            }
+        }
+
+        sort(order, n);
+
+        char* bounce = new char[MAX_RUN];
+        Ide* lastDevice = nullptr;
+        uint32_t i = 0;
+        while (i < n) {
+            auto first = order[i];
+            auto dev = first->device;
+            auto size = first->size;
+            ASSERT(size % dev->block_size == 0 && size <= MAX_RUN);
+
+            if (lastDevice != nullptr && lastDevice != dev) lastDevice->flush();
+            lastDevice = dev;
+
+            // neighbours on the same device go out in one command
+            uint32_t count = 0;
+            while (i < n && (count + 1) * size <= MAX_RUN) {
+                auto b = order[i];
+                if (b->device != dev || b->size != size || b->number != first->number + count) break;
+                // clean before we copy: a write that lands after this
+                // makes it dirty again
+                mark_clean(b);
+                memcpy(bounce + count * size, b->data, size);
+                count ++;
+                i ++;
+            }
+
+            uint32_t sectors = size / dev->block_size;
+            dev->write_blocks(first->number * sectors, count * sectors, bounce);
+            nWritten.add_fetch(count);
+        }
+        if (lastDevice != nullptr) lastDevice->flush();
+
+        delete[] bounce;
+        delete[] order;
+        delete[] held;
+    }
+
+    void set_budget(uint32_t bytes) {
+        for (uint32_t i = 0; i < SHARDS; i++) {
+            auto& s = shards[i];
+            Entry* victims;
+            {
+                LockGuard g{s.lock};
+                s.counts.budget = bytes / SHARDS;
+                victims = s.shrink();
+            }
+            release(victims);
+        }
+    }
+
+    Stats stats() {
+        Stats out { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+        for (uint32_t i = 0; i < SHARDS; i++) {
+            auto& s = shards[i];
+            LockGuard g{s.lock};
+            out.hits += s.counts.hits;
+            out.misses += s.counts.misses;
+            out.evictions += s.counts.evictions;
+            out.bytes += s.counts.bytes;
+            out.budget += s.counts.budget;
+            out.prefetched += s.counts.prefetched;
+            out.prefetch_hits += s.counts.prefetch_hits;
+            out.prefetch_waste += s.counts.prefetch_waste;
+        }
+        out.dirty = nDirty.get();
+        out.written = nWritten.get();
+        return out;
+    }
+}
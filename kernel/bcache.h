@@ -0,0 +1,93 @@
+#ifndef _bcache_h_
+#define _bcache_h_
+
+#include "stdint.h"
+#include "shared.h"
+#include "ide.h"
+
+// One cache of disk blocks for everybody (every Ext2, every Node)
+//
+//    - a block is named by its device and its number, in units of the
+//      block size the caller asks for (the file system's, not the disk's)
+//    - get() returns the block with its data in memory. The data stays
+//      put while you hold the Shared<Buffer>
+//    - once the cache is over its budget, blocks nobody holds are evicted
+//      in CLOCK order (a hit gives a block a second chance)
+//    - a miss reads the disk without holding the cache lock. If two
+//      threads miss on the same block they both read it, the one that
+//      gets back second uses the first one's copy
+//    - prefetch() brings a block in for somebody who's expected to want
+//      it soon (readahead). The stats say how many of those got used
+//      and how many were evicted untouched
+//    - writers change the data in place and call mark_dirty(). Dirty
+//      blocks are never evicted, sync() writes them all out (sorted by
+//      block number, neighbours in one disk command) and makes them clean.
+//      A block that's written while sync() copies it stays dirty
+//    - create() is for a block that was just allocated: it's zeroed and
+//      dirty, the old contents are never read
+
+struct Buffer : public Sharable<Buffer> {
+    Ide* const device;
+    const uint32_t number;
+    const uint32_t size;
+    char* const data;
+    volatile bool dirty = false;     // see BufferCache::mark_dirty
+
+    Buffer(Ide* device, uint32_t number, uint32_t size) :
+        device(device), number(number), size(size), data(new char[size]) {}
+
+    Buffer(const Buffer&) = delete;
+
+    ~Buffer() {
+        delete[] data;
+    }
+};
+
+namespace BufferCache {
+
+    struct Stats {
+        uint32_t hits;
+        uint32_t misses;
+        uint32_t evictions;
+        uint32_t bytes;        // in the cache right now
+        uint32_t budget;
+        uint32_t prefetched;   // blocks read by prefetch()
+        uint32_t prefetch_hits;
+        uint32_t prefetch_waste;
+        uint32_t dirty;        // blocks waiting for sync()
+        uint32_t written;      // blocks sync() wrote
+    };
+
+    constexpr uint32_t DEFAULT_BUDGET = 1024 * 1024;
+
+    // Reads the block if it isn't cached
+    Shared<Buffer> get(Borrowed<Ide> device, uint32_t number, uint32_t size);
+
+    // The block if it's cached, a null reference if it isn't. Doesn't
+    // read anything, a miss here means the caller reads it around the cache
+    Shared<Buffer> lookup(Borrowed<Ide> device, uint32_t number, uint32_t size);
+
+    // Reads the block into the cache if it isn't there yet
+    void prefetch(Borrowed<Ide> device, uint32_t number, uint32_t size);
+
+    // A zeroed block that's dirty from the start (no read)
+    Shared<Buffer> create(Borrowed<Ide> device, uint32_t number, uint32_t size);
+
+    // The buffer's data changed, sync() will write it
+    void mark_dirty(Borrowed<Buffer> buffer);
+
+    // Writes every dirty block and flushes the drives. One sync() at a time
+    void sync();
+
+    // Cheap, for deciding when to write back
+    uint32_t dirty_bytes();
+
+    // How many bytes of blocks to keep around (split evenly between the
+    // shards, see bcache.cc). Shrinking it evicts right away (as much as
+    // it can)
+    void set_budget(uint32_t bytes);
+
+    Stats stats();
+}
+
+#endif
@@ -0,0 +1,695 @@
+#ifdef BENCH
+
+#include "bench.h"
+#include "debug.h"
+#include "atomic.h"
+#include "config.h"
+#include "machine.h"
+#include "pit.h"
+#include "threads.h"
+#include "semaphore.h"
+#include "blocking_lock.h"
+#include "rwlock.h"
+#include "rcu.h"
+#include "shared.h"
+#include "future.h"
+#include "barrier.h"
+#include "process.h"
+#include "queue.h"
+#include "ext2.h"
+#include "bcache.h"
+
+namespace Bench {
+
+    // Power of two histogram of cycle counts
+    struct Histogram {
+        static constexpr uint32_t BUCKETS = 64;
+        uint32_t counts[BUCKETS];
+        uint64_t max;
+
+        Histogram() : counts(), max(0) {}
+
+        void add(uint64_t cycles) {
+            uint32_t b = (cycles == 0) ? 0 : 63 - __builtin_clzll(cycles);
+            counts[b] ++;
+            if (cycles > max) max = cycles;
+        }
+
+        void add(const Histogram& other) {
+            for (uint32_t i = 0; i < BUCKETS; i++) counts[i] += other.counts[i];
+            if (other.max > max) max = other.max;
+        }
+
+        // upper bound of the bucket that holds the given fraction (per 1000)
+        uint64_t percentile(uint32_t permille) const {
+            uint64_t total = 0;
+            for (uint32_t i = 0; i < BUCKETS; i++) total += counts[i];
+            uint64_t want = K::udiv64(total * permille + 999, 1000);
+            uint64_t seen = 0;
+            for (uint32_t i = 0; i < BUCKETS; i++) {
+                seen += counts[i];
+                if (seen >= want) return (((uint64_t) 1) << (i + 1)) - 1;
+            }
+            return max;
+        }
+    };
+
+    // Start n threads running work(i) together and wait for all of them.
+    // Returns the elapsed time in rdtsc ticks
+    template <typename Work>
+    uint64_t together(uint32_t n, Work work) {
+        Atomic<uint32_t> started{0};
+        Atomic<uint32_t> finished{0};
+        Atomic<uint64_t> begin{0};
+
+        for (uint32_t i = 0; i < n; i++) {
+            thread([&started, &finished, &begin, &work, n, i] {
+                if (started.add_fetch(1) == n) begin.set(rdtsc());
+                while (started.get() < n) yield();
+                work(i);
+                finished.add_fetch(1);
+            });
+        }
+        while (finished.get() < n) yield();
+        return rdtsc() - begin.get();
+    }
+
+    static void report(const char* what, uint32_t n, uint64_t ops, uint64_t ticks, const Histogram& h) {
+        uint64_t us = Pit::tscToMicros(ticks);
+        if (us == 0) us = 1;
+        Debug::printf("| bench %s threads=%d ops/ms=%d p50=%d p99=%d p999=%d max=%d cycles\n",
+            what, n,
+            (uint32_t) K::udiv64(ops * 1000, (uint32_t) us),
+            (uint32_t) h.percentile(500),
+            (uint32_t) h.percentile(990),
+            (uint32_t) h.percentile(999),
+            (uint32_t) h.max);
+    }
+
+    ////////////////
+    // Spin locks //
+    ////////////////
+
+    constexpr uint32_t LOCK_ITERATIONS = 20000;
+
+    template <typename Lock>
+    static void contend(const char* what, uint32_t n) {
+        Lock lock{};
+        volatile uint32_t counter = 0;
+        auto hists = new Histogram[n];
+
+        auto ticks = together(n, [&lock, &counter, hists](uint32_t me) {
+            auto& h = hists[me];
+            for (uint32_t i = 0; i < LOCK_ITERATIONS; i++) {
+                uint64_t t0 = rdtsc();
+                lock.lock();
+                uint64_t t1 = rdtsc();
+                counter = counter + 1;
+                lock.unlock();
+                h.add(t1 - t0);
+            }
+        });
+
+        ASSERT(counter == n * LOCK_ITERATIONS);
+        Histogram all{};
+        for (uint32_t i = 0; i < n; i++) all.add(hists[i]);
+        delete[] hists;
+        report(what, n, n * LOCK_ITERATIONS, ticks, all);
+    }
+
+    static void locks() {
+        uint32_t most = kConfig.totalProcs < 16 ? kConfig.totalProcs : 16;
+        for (uint32_t n = 1; n <= most; n *= 2) {
+            contend<InterruptSafe<TASLock>>("tas", n);
+            contend<InterruptSafe<TicketLock>>("ticket", n);
+            contend<InterruptSafe<MCSLock>>("mcs", n);
+        }
+    }
+
+    /////////////
+    // Mutexes //
+    /////////////
+
+    // what BlockingLock used to be
+    struct SemaphoreMutex {
+        Semaphore sem{1};
+        void lock() { sem.down(); }
+        void unlock() { sem.up(); }
+    };
+
+    static void mutexes() {
+        uint32_t most = kConfig.totalProcs < 16 ? kConfig.totalProcs : 16;
+        for (uint32_t n = 1; n <= most; n *= 2) {
+            contend<SemaphoreMutex>("semaphore-mutex", n);
+            contend<BlockingLock>("adaptive-mutex", n);
+        }
+    }
+
+    /////////////////////////
+    // Reader-writer locks //
+    /////////////////////////
+
+    constexpr uint32_t WRITE_EVERY = 16;    // one write per 16 operations
+
+    // a plain lock for comparison
+    struct ExclusiveRW {
+        TicketLock lock{};
+        using Reader = bool;
+        Reader lockRead() { lock.lock(); return true; }
+        void unlockRead(Reader) { lock.unlock(); }
+        void lockWrite() { lock.lock(); }
+        void unlockWrite() { lock.unlock(); }
+    };
+
+    template <typename Lock>
+    static void readMostly(const char* what, uint32_t n) {
+        Lock lock{};
+        volatile uint32_t values[8] = {};
+        Atomic<uint32_t> bad{0};
+        auto hists = new Histogram[n];
+
+        auto ticks = together(n, [&lock, &values, &bad, hists](uint32_t me) {
+            auto& h = hists[me];
+            for (uint32_t i = 0; i < LOCK_ITERATIONS; i++) {
+                uint64_t t0 = rdtsc();
+                if ((i % WRITE_EVERY) == 0) {
+                    WriteGuard g{lock};
+                    h.add(rdtsc() - t0);
+                    for (uint32_t j = 0; j < 8; j++) values[j] = values[j] + 1;
+                } else {
+                    ReadGuard g{lock};
+                    h.add(rdtsc() - t0);
+                    // a reader never sees a half done write
+                    for (uint32_t j = 1; j < 8; j++) {
+                        if (values[j] != values[0]) bad.add_fetch(1);
+                    }
+                }
+            }
+        });
+
+        ASSERT(bad.get() == 0);
+        Histogram all{};
+        for (uint32_t i = 0; i < n; i++) all.add(hists[i]);
+        delete[] hists;
+        report(what, n, n * LOCK_ITERATIONS, ticks, all);
+    }
+
+    struct PreferReadersRW : public SpinRWLock {
+        PreferReadersRW() : SpinRWLock(RWPolicy::PreferReaders) {}
+    };
+
+    static void rwlocks() {
+        uint32_t most = kConfig.totalProcs < 16 ? kConfig.totalProcs : 16;
+        for (uint32_t n = 1; n <= most; n *= 2) {
+            readMostly<ExclusiveRW>("rw-exclusive", n);
+            readMostly<SpinRWLock>("rw-spin", n);
+            readMostly<PreferReadersRW>("rw-spin-readers", n);
+            readMostly<BlockingRWLock>("rw-blocking", n);
+        }
+    }
+
+    /////////
+    // RCU //
+    /////////
+
+    struct Box : public Sharable<Box> {
+        uint32_t a;
+        uint32_t b;
+        Box(uint32_t v) : a(v), b(v) {}
+    };
+
+    // readers follow an RCU pointer, core 0 replaces the box now and then
+    static void rcuReaders(uint32_t n) {
+        RCU::Pointer<Box> current{new Box(0)};
+        SpinLock writer{};
+        Atomic<uint32_t> bad{0};
+        auto hists = new Histogram[n];
+
+        auto ticks = together(n, [&current, &writer, &bad, hists](uint32_t me) {
+            auto& h = hists[me];
+            for (uint32_t i = 0; i < LOCK_ITERATIONS; i++) {
+                if ((me == 0) && ((i % WRITE_EVERY) == 0)) {
+                    LockGuard g{writer};
+                    auto old = current.publish(new Box(i));
+                    RCU::retire(old);
+                    continue;
+                }
+                uint64_t t0 = rdtsc();
+                RCU::ReadGuard g{};
+                auto box = current.read();
+                if (box->a != box->b) bad.add_fetch(1);
+                h.add(rdtsc() - t0);
+            }
+        });
+
+        ASSERT(bad.get() == 0);
+        RCU::retire(current.publish(nullptr));
+        Histogram all{};
+        for (uint32_t i = 0; i < n; i++) all.add(hists[i]);
+        delete[] hists;
+        report("rcu-read", n, n * LOCK_ITERATIONS, ticks, all);
+    }
+
+    // the same thing with a reader-writer lock and a reference per read
+    static void sharedReaders(uint32_t n) {
+        Shared<Box> current = Shared<Box>::make(0);
+        SpinRWLock lock{};
+        Atomic<uint32_t> bad{0};
+        auto hists = new Histogram[n];
+
+        auto ticks = together(n, [&current, &lock, &bad, hists](uint32_t me) {
+            auto& h = hists[me];
+            for (uint32_t i = 0; i < LOCK_ITERATIONS; i++) {
+                if ((me == 0) && ((i % WRITE_EVERY) == 0)) {
+                    WriteGuard g{lock};
+                    current = Shared<Box>::make(i);
+                    continue;
+                }
+                uint64_t t0 = rdtsc();
+                Shared<Box> box;
+                {
+                    ReadGuard g{lock};
+                    box = current;
+                }
+                if (box->a != box->b) bad.add_fetch(1);
+                h.add(rdtsc() - t0);
+            }
+        });
+
+        ASSERT(bad.get() == 0);
+        Histogram all{};
+        for (uint32_t i = 0; i < n; i++) all.add(hists[i]);
+        delete[] hists;
+        report("shared-read", n, n * LOCK_ITERATIONS, ticks, all);
+    }
+
+    static void rcu() {
+        uint32_t most = kConfig.totalProcs < 16 ? kConfig.totalProcs : 16;
+        for (uint32_t n = 1; n <= most; n *= 2) {
+            rcuReaders(n);
+            sharedReaders(n);
+        }
+        RCU::synchronize();
+    }
+
+    /////////////
+    // Futures //
+    /////////////
+
+    constexpr uint32_t FUTURE_ROUNDS = 1000;
+
+    // a round: two jobs, a continuation on each and a join, with nobody
+    // blocked until the very end
+    static void futures() {
+        Histogram h{};
+        uint64_t start = rdtsc();
+        for (uint32_t i = 0; i < FUTURE_ROUNDS; i++) {
+            uint64_t t0 = rdtsc();
+            auto a = future<uint32_t>([i] { return i; })
+                ->then<uint32_t>([](uint32_t v) { return v + 1; });
+            auto b = future<uint32_t>([i] { return 2 * i; })
+                ->then<uint32_t>([](uint32_t v) { return v + 1; });
+            auto first = when_any(a, b);
+            auto all = when_all(a, b);
+            ASSERT(all->get() == 2);
+            ASSERT(first->get() < 2);
+            ASSERT(a->is_ready() && b->is_ready());
+            ASSERT(a->get() + b->get() == 3 * i + 2);
+            h.add(rdtsc() - t0);
+        }
+        report("future-round", 1, FUTURE_ROUNDS, rdtsc() - start, h);
+    }
+
+    //////////////
+    // Barriers //
+    //////////////
+
+    constexpr uint32_t BARRIER_ROUNDS = 2000;
+
+    // n threads go through "rounds" barriers, sync(i, round) is the barrier
+    template <typename Sync>
+    static void barrier(const char* what, uint32_t n, Sync sync) {
+        auto hists = new Histogram[n];
+        auto ticks = together(n, [&sync, hists](uint32_t me) {
+            for (uint32_t r = 0; r < BARRIER_ROUNDS; r++) {
+                uint64_t t0 = rdtsc();
+                sync(me, r);
+                hists[me].add(rdtsc() - t0);
+            }
+        });
+        Histogram all{};
+        for (uint32_t i = 0; i < n; i++) all.add(hists[i]);
+        delete[] hists;
+        report(what, n, BARRIER_ROUNDS, ticks, all);
+    }
+
+    static void barriers() {
+        uint32_t most = kConfig.totalProcs < 16 ? kConfig.totalProcs : 16;
+        for (uint32_t n = 2; n <= most; n *= 2) {
+            {
+                // one shot, a new one for every round
+                auto rounds = new Shared<Barrier>[BARRIER_ROUNDS];
+                for (uint32_t r = 0; r < BARRIER_ROUNDS; r++) {
+                    rounds[r] = Shared<Barrier>::make(n);
+                }
+                barrier("barrier", n, [rounds](uint32_t, uint32_t r) { rounds[r]->sync(); });
+                delete[] rounds;
+            }
+            {
+                ReusableBarrier b{n};
+                barrier("reusable-barrier", n, [&b](uint32_t, uint32_t) { b.sync(); });
+            }
+            {
+                SenseBarrier b{n};
+                barrier("sense-barrier", n, [&b](uint32_t, uint32_t) { b.sync(); });
+            }
+            {
+                TreeBarrier b{n};
+                barrier("tree-barrier", n, [&b](uint32_t me, uint32_t) { b.sync(me); });
+            }
+        }
+    }
+
+    ////////////
+    // Queues //
+    ////////////
+
+    constexpr uint32_t QUEUE_ITEMS = 4000;    // per thread
+
+    struct Item {
+        Item* volatile next = nullptr;
+        volatile uint32_t seen = 0;
+    };
+
+    // Every thread adds its own items and removes whatever it finds, so
+    // most items change cores on the way. At the end every item has to
+    // have come out exactly once
+    template <typename Q>
+    static void handoff(const char* what, uint32_t n) {
+        Q q{};
+        auto items = new Item[n * QUEUE_ITEMS];
+        Atomic<uint32_t> removed{0};
+        auto hists = new Histogram[n];
+
+        auto ticks = together(n, [&q, &removed, items, hists](uint32_t me) {
+            auto& h = hists[me];
+            auto mine = items + me * QUEUE_ITEMS;
+            uint32_t got = 0;
+            for (uint32_t i = 0; i < QUEUE_ITEMS; i++) {
+                uint64_t t0 = rdtsc();
+                q.add(&mine[i]);
+                auto it = q.remove();
+                h.add(rdtsc() - t0);
+                if (it != nullptr) {
+                    it->seen = it->seen + 1;
+                    got ++;
+                }
+            }
+            removed.add_fetch(got);
+        });
+
+        // a remove can miss an add that's in flight, drain what's left
+        uint32_t left = 0;
+        while (auto it = q.remove()) {
+            it->seen = it->seen + 1;
+            left ++;
+        }
+        ASSERT(removed.get() + left == n * QUEUE_ITEMS);
+        for (uint32_t i = 0; i < n * QUEUE_ITEMS; i++) ASSERT(items[i].seen == 1);
+
+        Histogram all{};
+        for (uint32_t i = 0; i < n; i++) all.add(hists[i]);
+        delete[] hists;
+        delete[] items;
+        report(what, n, 2 * n * QUEUE_ITEMS, ticks, all);
+    }
+
+    static void queues() {
+        for (uint32_t n = 1; n <= kConfig.totalProcs; n *= 2) {
+            handoff<Queue<Item,InterruptSafe<TicketLock>>>("queue", n);
+            handoff<MPSCQueue<Item,InterruptSafe<TicketLock>>>("mpsc-queue", n);
+        }
+    }
+
+    /////////////////
+    // File system //
+    /////////////////
+
+    constexpr uint32_t FILE_ROUNDS = 200;
+
+    static void cacheReport() {
+        auto s = BufferCache::stats();
+        Debug::printf("| cache hits=%d misses=%d evictions=%d bytes=%d budget=%d\n",
+            s.hits, s.misses, s.evictions, s.bytes, s.budget);
+        Debug::printf("| cache prefetched=%d prefetch-hits=%d prefetch-waste=%d\n",
+            s.prefetched, s.prefetch_hits, s.prefetch_waste);
+        Debug::printf("| cache dirty=%d written=%d\n", s.dirty, s.written);
+    }
+
+    // open and read the whole file, over and over. The first round goes
+    // to the disk, the rest should come from the buffer cache
+    static void files(Shared<Ext2> fs) {
+        const char* names[] = { "/sbin/init", "/sbin/shell", "/etc/data.txt" };
+        for (auto name : names) {
+            auto probe = fs->open(fs->root, name);
+            if (probe == nullptr) continue;
+            uint32_t sz = probe->size_in_bytes();
+            auto buffer = new char[sz + 1];
+            Histogram h{};
+            uint64_t start = rdtsc();
+            for (uint32_t i = 0; i < FILE_ROUNDS; i++) {
+                uint64_t t0 = rdtsc();
+                auto file = fs->open(fs->root, name);
+                ASSERT(file->read_all(0, sz, buffer) == sz);
+                h.add(rdtsc() - t0);
+            }
+            report(name, 1, FILE_ROUNDS, rdtsc() - start, h);
+            delete[] buffer;
+        }
+        cacheReport();
+    }
+
+    // Everybody opens and reads the same file at once: lookups share the
+    // name and inode caches, reads share the node and the buffer cache
+    static void parallelReads(Shared<Ext2> fs) {
+        const char* name = "/fortunes";
+        auto probe = fs->open(fs->root, name);
+        if (probe == nullptr) return;
+        uint32_t sz = probe->size_in_bytes();
+        for (uint32_t n = 1; n <= kConfig.totalProcs; n *= 2) {
+            auto hists = new Histogram[n];
+            auto ticks = together(n, [fs, name, sz, hists](uint32_t me) {
+                auto buffer = new char[sz];
+                for (uint32_t i = 0; i < FILE_ROUNDS; i++) {
+                    uint64_t t0 = rdtsc();
+                    auto file = fs->open(fs->root, name);
+                    ASSERT(file->read_all(0, sz, buffer) == sz);
+                    hists[me].add(rdtsc() - t0);
+                }
+                delete[] buffer;
+            });
+            Histogram all{};
+            for (uint32_t i = 0; i < n; i++) all.add(hists[i]);
+            delete[] hists;
+            report("parallel-read", n, n * FILE_ROUNDS, ticks, all);
+        }
+    }
+
+    // Sequential reads of a big file, from a cold buffer cache. There's
+    // no big file on the test disks, drop one in first:
+    //     dd if=/dev/urandom of=t0.dir/data/big bs=1M count=4
+    constexpr const char* BIG_FILE = "/data/big";
+    constexpr uint32_t BIG_CHUNK = 64 * 1024;
+
+    static void bigFile(Shared<Ext2> fs) {
+        auto file = fs->open(fs->root, BIG_FILE);
+        if (file == nullptr) {
+            Debug::printf("| bench big-file skipped, no %s\n", BIG_FILE);
+            return;
+        }
+        uint32_t sz = file->size_in_bytes();
+        uint32_t blocks = (sz + fs->get_block_size() - 1) / fs->get_block_size();
+        auto buffer = new char[BIG_CHUNK];
+        // the first pass also fills the node's block map, the second one has it
+        const char* passes[] = { "big-file-cold-map", "big-file-warm-map" };
+        for (auto what : passes) {
+            auto budget = BufferCache::stats().budget;
+            BufferCache::set_budget(0);
+            BufferCache::set_budget(budget);
+            uint32_t misses = BufferCache::stats().misses;
+            Histogram h{};
+            uint64_t start = rdtsc();
+            for (uint32_t offset = 0; offset < sz; offset += BIG_CHUNK) {
+                uint64_t t0 = rdtsc();
+                ASSERT(file->read_all(offset, BIG_CHUNK, buffer) > 0);
+                h.add(rdtsc() - t0);
+            }
+            uint64_t us = Pit::tscToMicros(rdtsc() - start);
+            if (us == 0) us = 1;
+            misses = BufferCache::stats().misses - misses;
+            Debug::printf("| bench %s bytes=%d KB/s=%d disk-reads-per-100-blocks=%d p50=%d max=%d cycles\n",
+                what, sz,
+                (uint32_t) K::udiv64(((uint64_t) sz) * 1000000 / 1024, (uint32_t) us),
+                (misses * 100) / blocks,
+                (uint32_t) h.percentile(500),
+                (uint32_t) h.max);
+        }
+        delete[] buffer;
+    }
+
+    // Appends to a new file in small writes (they only touch memory, the
+    // blocks get disk blocks at write-back), then fsync() puts it on the
+    // disk. The same file in /tmp never goes near the disk
+    constexpr uint32_t WRITE_BYTES = 512 * 1024;
+    constexpr uint32_t WRITE_CHUNK = 4096;
+
+    static void writeFile(Shared<Ext2> fs, const char* name, const char* what) {
+        auto file = fs->create(fs->root, name);
+        ASSERT(file != nullptr);
+        auto buffer = new char[WRITE_CHUNK];
+        for (uint32_t i = 0; i < WRITE_CHUNK; i++) buffer[i] = 'a' + i % 26;
+        uint32_t base = file->size_in_bytes();
+        uint32_t written = BufferCache::stats().written;
+
+        Histogram h{};
+        uint64_t start = rdtsc();
+        for (uint32_t offset = 0; offset < WRITE_BYTES; offset += WRITE_CHUNK) {
+            uint64_t t0 = rdtsc();
+            ASSERT(file->write(base + offset, WRITE_CHUNK, buffer) == (int32_t) WRITE_CHUNK);
+            h.add(rdtsc() - t0);
+        }
+        report(what, 1, WRITE_BYTES / WRITE_CHUNK, rdtsc() - start, h);
+
+        uint64_t t0 = rdtsc();
+        file->sync();
+        uint64_t us = Pit::tscToMicros(rdtsc() - t0);
+        Debug::printf("| bench %s fsync bytes=%d us=%d blocks-written=%d\n",
+            what, WRITE_BYTES, (uint32_t) us, BufferCache::stats().written - written);
+
+        // and it reads back
+        auto check = new char[WRITE_CHUNK];
+        ASSERT(file->read_all(base + WRITE_BYTES - WRITE_CHUNK, WRITE_CHUNK, check) == WRITE_CHUNK);
+        for (uint32_t i = 0; i < WRITE_CHUNK; i++) ASSERT(check[i] == buffer[i]);
+        delete[] check;
+        delete[] buffer;
+    }
+
+    static void writes(Shared<Ext2> fs) {
+        writeFile(fs, "/bench.out", "write-4k-ext2");
+        writeFile(fs, "/tmp/bench.out", "write-4k-tmpfs");
+        cacheReport();
+    }
+
+    ///////////////////
+    // System calls //
+    ///////////////////
+
+    constexpr uint32_t SYSCALL_ROUNDS = 20000;
+    constexpr uint32_t OPEN_ROUNDS = 2000;
+
+    // A system call from the kernel. A trap from ring 0 doesn't push esp
+    // so we push it ourselves, the handler finds the arguments above it
+    static int syscall(uint32_t num, uint32_t* args) {
+        int out;
+        asm volatile("push %2\n\tint $48\n\tadd $4,%%esp"
+            : "=a"(out)
+            : "0"(num), "r"(args - 1)
+            : "ecx", "edx", "memory", "cc");
+        return out;
+    }
+
+    // these match t0.dir/sbin/sys.S
+    constexpr uint32_t SYS_CLOSE = 6;
+    constexpr uint32_t SYS_OPEN = 10;
+    constexpr uint32_t SYS_LEN = 11;
+    constexpr uint32_t SYS_READ = 12;
+
+    static void syscalls(Shared<Ext2> fs) {
+        Semaphore done{0};
+        auto pcb = Shared<PCB>{new Process(fs)};
+        thread(pcb, [&done] {
+            {
+                // the cheapest one there is: len(stdin) is -1
+                Histogram h{};
+                uint32_t args[1] = { 0 };
+                uint64_t start = rdtsc();
+                for (uint32_t i = 0; i < SYSCALL_ROUNDS; i++) {
+                    uint64_t t0 = rdtsc();
+                    ASSERT(syscall(SYS_LEN, args) == -1);
+                    h.add(rdtsc() - t0);
+                }
+                report("syscall", 1, SYSCALL_ROUNDS, rdtsc() - start, h);
+            }
+            {
+                // path lookup, a descriptor and back
+                Histogram h{};
+                uint32_t args[1] = { (uint32_t) "/sbin/init" };
+                uint64_t start = rdtsc();
+                for (uint32_t i = 0; i < OPEN_ROUNDS; i++) {
+                    uint64_t t0 = rdtsc();
+                    int fd = syscall(SYS_OPEN, args);
+                    ASSERT(fd >= 0);
+                    uint32_t close_args[1] = { (uint32_t) fd };
+                    ASSERT(syscall(SYS_CLOSE, close_args) == 0);
+                    h.add(rdtsc() - t0);
+                }
+                report("open-close", 1, OPEN_ROUNDS, rdtsc() - start, h);
+            }
+            {
+                // a cp() loop from a cold cache: small sequential reads
+                // that readahead should keep ahead of
+                auto budget = BufferCache::stats().budget;
+                BufferCache::set_budget(0);
+                BufferCache::set_budget(budget);
+                auto before = BufferCache::stats();
+
+                // the buffer has to be in user space, it gets paged in
+                char* buffer = (char*) 0x90000000;
+                uint32_t args[1] = { (uint32_t) "/fortunes" };
+                int fd = syscall(SYS_OPEN, args);
+                ASSERT(fd >= 0);
+                Histogram h{};
+                uint32_t ops = 0;
+                uint64_t start = rdtsc();
+                while (true) {
+                    uint32_t read_args[3] = { (uint32_t) fd, (uint32_t) buffer, 100 };
+                    uint64_t t0 = rdtsc();
+                    int n = syscall(SYS_READ, read_args);
+                    h.add(rdtsc() - t0);
+                    ops ++;
+                    if (n <= 0) break;
+                }
+                report("read-100", 1, ops, rdtsc() - start, h);
+                uint32_t close_args[1] = { (uint32_t) fd };
+                ASSERT(syscall(SYS_CLOSE, close_args) == 0);
+
+                auto after = BufferCache::stats();
+                Debug::printf("| bench read-100 misses=%d prefetched=%d prefetch-hits=%d prefetch-waste=%d\n",
+                    after.misses - before.misses,
+                    after.prefetched - before.prefetched,
+                    after.prefetch_hits - before.prefetch_hits,
+                    after.prefetch_waste - before.prefetch_waste);
+            }
+            done.up();
+        });
+        done.down();
+    }
+
+    void run(Shared<Ext2> fs) {
+        Debug::printf("| running benchmarks on %d cores\n", kConfig.totalProcs);
+        locks();
+        mutexes();
+        rwlocks();
+        rcu();
+        futures();
+        barriers();
+        queues();
+        files(fs);
+        parallelReads(fs);
+        bigFile(fs);
+        writes(fs);
+        syscalls(fs);
+    }
+}
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef _bench_h_
+#define _bench_h_
+
+#include "stdint.h"
+#include "shared.h"
+#include "ext2.h"
+
+// Kernel microbenchmarks. They are not built by default:
+//
+//     make KFLAGS=-DBENCH ...
+//
+// kernelMain runs them (before starting init, on the root file system)
+// and they report on the console. The numbers come from rdtsc, so they're only comparable
+// on the same machine.
+
+namespace Bench {
+    void run(Shared<Ext2> fs);
+}
+
+#endif
@@ -3,33 +3,39 @@
 #include "libk.h"
 #include "debug.h"
 
+void BlockIO::read_blocks(uint32_t first, uint32_t count, char* buffer) {
+    for (uint32_t i = 0; i < count; i++) {
+        read_block(first + i, buffer + i * block_size);
+    }
+}
+
+void BlockIO::read_part(uint32_t block_number, uint32_t offset, uint32_t n, char* buffer) {
+    ASSERT(offset + n <= block_size);
+    char* temp = new char[block_size];
+    read_block(block_number, temp);
+    ::memcpy(buffer, &temp[offset], n);
+    delete []temp;
+}
+
 int64_t BlockIO::read(uint32_t offset, uint32_t desired_n, char* buffer) {
     auto sz = size_in_bytes();
     if (offset > sz) return -1;
     if (offset == sz) return 0;
 
     auto n = K::min(desired_n,sz - offset);
-    //auto end_offset = K::min(offset+n,sz);
     auto block_number = offset / block_size;
     auto offset_in_block = offset % block_size;
-    auto actual_n = K::min(block_size - offset_in_block, n);
-    ASSERT(actual_n <= n);
-    ASSERT(offset + actual_n <= sz);
-    if (actual_n == block_size) {
-//        Debug::printf("reading whole block %d\n",block_number);
-        ASSERT(offset_in_block == 0);
-        // we can read in-place
-        read_block(block_number,buffer);
-    } else {
-        ASSERT(offset_in_block + actual_n <= block_size);
-        char* temp = new char[block_size];
-//        Debug::printf("reading partial block %d\n",block_number);
-        read_block(block_number,temp);
-//        Debug::printf("getting %d bytes starting at block offset %d\n",actual_n,offset_in_block);
-        ::memcpy(buffer,&temp[offset_in_block],actual_n);
-        delete []temp;
+    if (offset_in_block != 0 || n < block_size) {
+        // the partial block at either end
+        auto actual_n = K::min(block_size - offset_in_block, n);
+        ASSERT(offset + actual_n <= sz);
+        read_part(block_number, offset_in_block, actual_n, buffer);
+        return actual_n;
     }
-    return actual_n;
+    // whole blocks, we can read them in-place
+    auto count = n / block_size;
+    read_blocks(block_number, count, buffer);
+    return count * block_size;
 }
 
 int64_t BlockIO::read_all(uint32_t offset, uint32_t n, char* buffer) {
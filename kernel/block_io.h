@@ -10,7 +10,8 @@
 // Assumptions:
 //    - block size is a power of 2
 //    - block size is fixed
-//    - the caller is responsible for serializaing access (locking, etc)
+//    - it's safe to read from many threads at once (disks serialize
+//      their own commands, files go through the buffer cache)
 //    - the caller is responsible for ensuring that buffers assed in
 //      as arguments are large enough for the required operation
 //    - the caller is also responsibile for ensuring that all offsets
@@ -36,7 +37,18 @@ public:
     // Read a block and put its bytes in the given buffer
     virtual void read_block(uint32_t block_number, char* buffer) = 0;
 
+    // Read "count" consecutive blocks into the buffer. The default reads
+    // them one at a time, devices and files do better
+    virtual void read_blocks(uint32_t first, uint32_t count, char* buffer);
+
+    // Read "n" bytes starting "offset" bytes into the given block
+    // (offset + n <= block_size). The default goes through a temporary
+    // block, devices and files do better
+    virtual void read_part(uint32_t block_number, uint32_t offset, uint32_t n, char* buffer);
+
     // Read up to "n" bytes starting at "offset" and put the restuls in "buffer".
+    // A partial block at either end is read by itself, whole blocks in
+    // the middle all at once.
     // returns:
     //   > 0  actual number of bytes read
     //   = 0  end (offset == size_in_bytes)
@@ -1,2 +1,72 @@
 #include "blocking_lock.h"
+#include "smp.h"
+#include "config.h"
 
+using namespace gheith;
+
+// How many times we look at a running owner before we give up and park
+constexpr static uint32_t SPIN_LIMIT = 2000;
+
+// owner of the locks taken before the scheduler is running
+static TCB* const BOOT = (TCB*) 1;
+
+TCB* BlockingLock::self() {
+    if (SMP::running.get() == 0) return BOOT;
+    return current();
+}
+
+static bool isRunning(TCB* tcb) {
+    for (uint32_t i = 0; i < kConfig.totalProcs; i++) {
+        if (activeThreads[i] == tcb) return true;
+    }
+    return false;
+}
+
+void BlockingLock::lockSlow(TCB* me) {
+    if (me == BOOT || me->isIdle) {
+        // nowhere to go
+        while (!tryLock(me)) iAmStuckInALoop(false);
+        return;
+    }
+
+    for (uint32_t i = 0; i < SPIN_LIMIT; i++) {
+        TCB* it = owner;
+        if (it == nullptr) {
+            if (tryLock(me)) return;
+        } else if ((it == BOOT) || !isRunning(it)) {
+            break;
+        }
+        iAmStuckInALoop(false);
+    }
+
+    // Park. Whoever takes us off the queue also makes us the owner
+    block(BlockOption::MustBlock, [this](TCB* me) {
+        guard.lock();
+        nWaiting.add_fetch(1);
+        if (tryLock(me)) {
+            nWaiting.add_fetch(-1);
+            guard.unlock();
+            schedule(me);
+            return;
+        }
+        // An unlock that comes after this point saw nWaiting and will
+        // find us once we let go of the guard
+        waiting.add(me);
+        guard.unlock();
+    });
+
+    ASSERT(owner == me);
+}
+
+void BlockingLock::unlockSlow() {
+    TCB* next = nullptr;
+    guard.lock();
+    auto first = waiting.peek();
+    if ((first != nullptr) && tryLock(first)) {
+        next = waiting.remove();
+        nWaiting.add_fetch(-1);
+    }
+    guard.unlock();
+    // if somebody beat us to it their unlock will wake the waiter up
+    if (next != nullptr) schedule(next);
+}
@@ -2,18 +2,66 @@
 #define _blocking_lock_h_
 
 #include "debug.h"
-#include "semaphore.h"
+#include "atomic.h"
+#include "queue.h"
+#include "shared.h"
+#include "threads.h"
 
+// An adaptive mutex
+//
+//    - lock() grabs a free lock with a single cmpxchg
+//    - if the owner is running on another core it's probably about to
+//      let go, so we spin for a little while
+//    - otherwise (or if it takes too long) we park. unlock() hands the
+//      lock directly to the first parked thread, it wakes up owning it
+//    - idle threads can't block, they just spin
+//    - before the other cores and the scheduler are up there is nobody
+//      to wait for; the lock is owned by "boot"
 class BlockingLock : public Sharable<BlockingLock> {
-    Semaphore mut;
+    gheith::TCB* volatile owner;
+    Atomic<uint32_t> nWaiting;            // in "waiting" or on their way in
+    InterruptSafeLock guard;              // protects "waiting"
+    Queue<gheith::TCB,NoLock> waiting;
+    LOCK_PROFILE_STATE
+
+    bool tryLock(gheith::TCB* me) {
+        gheith::TCB* expected = nullptr;
+        return __atomic_compare_exchange_n(&owner, &expected, me, false,
+            __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    }
+
+    void lockSlow(gheith::TCB* me);
+    void unlockSlow();
+
 public:
-    inline BlockingLock() : mut{1} {}
-    inline void lock() { mut.down(); }
-    inline void unlock() { mut.up(); }
-    inline bool isMine() { return true; }
-};
+    inline BlockingLock() : owner(nullptr), nWaiting(0), guard(), waiting() {}
 
+    BlockingLock(const BlockingLock&) = delete;
 
+    // the TCB we own the lock as
+    static gheith::TCB* self();
 
-#endif
+    LOCK_PROFILE_INLINE void lock() {
+        LOCK_PROFILE_BEGIN
+        auto me = self();
+        if (!tryLock(me)) {
+            LOCK_PROFILE_CONTENDED
+            lockSlow(me);
+        }
+        LOCK_PROFILE_ACQUIRED
+    }
 
+    inline void unlock() {
+        ASSERT(isMine());
+        LOCK_PROFILE_RELEASE
+        __atomic_store_n(&owner, nullptr, __ATOMIC_SEQ_CST);
+        // pairs with the waiter announcing itself before its last try
+        if (nWaiting.get() != 0) unlockSlow();
+    }
+
+    inline bool isMine() {
+        return owner == self();
+    }
+};
+
+#endif
@@ -5,6 +5,8 @@
 #include "atomic.h"
 #include "threads.h"
 #include "shared.h"
+#include "timer.h"
+#include "pit.h"
 
 // A Mesa-style condition variable
 //    - protected by a mutual exclusion lock. The lock protocol is:
@@ -103,6 +105,64 @@ public:
         ASSERT(the_lock.isMine());
     }
 
+    // Like wait() but gives up after (at least) "ns" nanoseconds
+    //
+    // Pre-condition: holding the lock
+    // Post-condition: holding the lock
+    // Returns: false if we timed out, true otherwise. Same non-guarantees as wait()
+    bool wait(uint64_t ns) {
+        using namespace gheith;
+
+        ASSERT(the_lock.isMine());
+
+        uint32_t ticks = Pit::nsToJiffies(ns);
+        if (ticks == 0) return false;
+
+        auto old_epoch = epoch;
+        TCB* volatile waiter = nullptr;
+        volatile bool timed_out = false;
+
+        // Whoever removes us from the queue (notify or the timer) gets to schedule us
+        auto timeout = Timers::timer([this, &waiter, &timed_out] {
+            the_lock.lock();
+            bool found = queue.remove(waiter);
+            the_lock.unlock();
+            if (found) {
+                timed_out = true;
+                schedule(waiter);
+            }
+        });
+
+        the_lock.unlock();
+
+        // Unlike wait(), this one has to get as far as arming the timer:
+        // with CanReturn and nothing else to run we'd be back right away
+        // and a "while (!pred) wait(ns)" loop would spin past its deadline
+        block(BlockOption::MustBlock,[this, old_epoch, &waiter, &timeout, ticks](TCB* me) {
+            ASSERT(!me->isIdle);
+
+            the_lock.lock();
+
+            if (old_epoch == epoch) {
+                waiter = me;
+                queue.add(me);
+                Timers::arm(&timeout, ticks);
+                the_lock.unlock();
+            } else {
+                the_lock.unlock();
+                schedule(me);
+            }
+        });
+
+        // either it fired or we make sure it never will
+        Timers::cancel(&timeout);
+
+        the_lock.lock();
+
+        ASSERT(the_lock.isMine());
+        return !timed_out;
+    }
+
     // Pre-condition: has the lock
     // Post-condition: has the lock
     // Guarantee: will never release the lock
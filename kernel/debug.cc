@@ -36,6 +36,9 @@ void Debug::shutdown() {
     if (checks.get() > 0) {
         printf("*** passed %d checkes\n",checks.get());
     }
+#ifdef LOCK_PROFILE
+    LockProfile::report();
+#endif
     printf("core %d requested shutdown\n",SMP::me());
     shutdown_called = true;
     while (true) {
@@ -4,6 +4,7 @@
 #include "pcb.h"
 #include "shared.h"
 #include "io.h"
+#include "future.h"
 
 namespace Descriptor {
 
@@ -12,6 +13,9 @@ namespace Descriptor {
     constexpr uint32_t TYPE_FD = 0x00000000;
     constexpr uint32_t TYPE_PD = 0x10000000;
     constexpr uint32_t TYPE_SD = 0x20000000;
+
+    // wait() for whichever child finishes first
+    constexpr uint32_t WAIT_ANY = 0xffffffff;
     
     struct FD : public Sharable<FD> {
 	static const Shared<FD> empty;
@@ -20,12 +24,15 @@ namespace Descriptor {
 	virtual int len()      		{ return -1; }
 	virtual int read(char*, int)	{ return -1; }
 	virtual int seek(int)		{ return -1; }
+	virtual int sync()		{ return -1; }
     };
 
     struct PD : public Sharable<PD> {
 	static const Shared<PD> empty;
 	virtual ~PD() {}
  	virtual int wait(uint32_t*) { return -1; }
+	// set when the child exits (null for the empty one)
+	virtual Shared<Future<int>> done() { return Shared<Future<int>>{}; }
     };
 
     struct SD : public Sharable<SD> {
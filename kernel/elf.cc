@@ -24,7 +24,7 @@ namespace ELF {
 	uint32_t align;	
     };
 
-    bool read_header(Shared<Node> file, Header& eh) {
+    bool read_header(Borrowed<Node> file, Header& eh) {
 	
 	if (file->size_in_bytes() < sizeof(Header))
 	    return false;
@@ -68,7 +68,7 @@ namespace ELF {
 	return true;
     }
 
-    uint32_t load(Shared<Node> file, Header& eh) {
+    uint32_t load(Borrowed<Node> file, Header& eh) {
 	for (uint32_t i = 0; i < eh.phentnum; i++) {
 	    ProgramHeader phent;
 	    file->read(eh.phoff+(i*eh.phentsize), phent);
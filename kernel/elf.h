@@ -22,10 +22,10 @@ namespace ELF {
 	uint16_t shstrndx;
     };
 
-    bool read_header(Shared<Node>, Header&);
-    uint32_t load(Shared<Node>, Header&);
+    bool read_header(Borrowed<Node>, Header&);
+    uint32_t load(Borrowed<Node>, Header&);
     
-    int load(Shared<Node>, uint32_t&);
+    int load(Borrowed<Node>, uint32_t&);
 }
 
 #endif
@@ -1,66 +1,274 @@
 #include "ext2.h"
 #include "libk.h"
+#include "workers.h"
+#include "rcu.h"
 
 // Node
 
-/* Read a block from the file
- * TODO caching
- */
-void Node::read_block(uint32_t number, char* buffer) {
-    if (number == cache_num) {
-    	memcpy(buffer, cache, block_size);
-    	return;
+uint32_t Node::pointer(uint32_t block, uint32_t index) {
+    if (block == 0) return 0;     // a hole in the tree, everything under it is a hole too
+    auto b = BufferCache::get(ide, block, block_size);
+    return ((uint32_t*) b->data)[index];
+}
+
+Node::BlockMap* Node::block_map(uint32_t leaf) {
+    const uint32_t pc1 = block_size / sizeof(uint32_t);
+    BlockMap* volatile* link = &map;
+    uint32_t first = 0;
+    while (true) {
+	auto it = *link;
+	if (it == nullptr) {
+	    // the leaves the file has now, room to grow if a writer is past them
+	    const uint32_t blocks = (size + block_size - 1) / block_size;
+	    const uint32_t have = (blocks > 12) ? (blocks - 12 + pc1 - 1) / pc1 : 0;
+	    uint32_t leaves = (have > leaf) ? have - first : leaf + 1 - first;
+	    if (leaf >= have && leaves < MAP_GROWTH) leaves = MAP_GROWTH;
+	    it = new BlockMap(first, leaves, pc1);
+
+	    BlockMap* expected = nullptr;
+	    if (!__atomic_compare_exchange_n(link, &expected, it, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		// somebody else got there first
+		delete it;
+		it = expected;
+	    }
+	}
+	if (leaf < it->first + it->leaves) return it;
+	first = it->first + it->leaves;
+	link = &it->next;
     }
-    if (!cache) cache = new char[block_size];
-    cache_num = number;
+}
+
+uint32_t Node::leaf_block(uint32_t leaf) {
+    const uint32_t pc1 = block_size / sizeof(uint32_t);
+    if (leaf == 0) {
+	// singly indirect
+	return data[12];
+    }
+    leaf -= 1;
+    if (leaf < pc1) {
+	// under the doubly indirect block
+	return pointer(data[13], leaf);
+    }
+    leaf -= pc1;
+    // under the trebly indirect block
+    return pointer(pointer(data[14], leaf / pc1), leaf % pc1);
+}
+
+uint32_t* Node::slot(uint32_t number) {
+    const uint32_t pc1 = block_size / sizeof(uint32_t);
+    const uint32_t leaf = number / pc1;
+    auto m = block_map(leaf);
+    const uint32_t i = leaf - m->first;
+    uint32_t* out = &m->blocks[i * pc1];
+    if (!__atomic_load_n(&m->loaded[i], __ATOMIC_ACQUIRE)) {
+	// a writer changing this leaf holds the lock, we don't copy half of it
+	LockGuard g{map_lock};
+	if (!m->loaded[i]) {
+	    uint32_t block = leaf_block(leaf);
+	    if (block == 0) {
+		bzero(out, block_size);
+	    } else {
+		auto b = BufferCache::get(ide, block, block_size);
+		memcpy(out, b->data, block_size);
+	    }
+	    __atomic_store_n(&m->loaded[i], true, __ATOMIC_RELEASE);
+	}
+    }
+    return &out[number % pc1];
+}
+
+uint32_t Node::physical(uint32_t number) {
     if (number < 12) {
 	// direct block
-	uint32_t offset = data[number] * block_size;
-	ide->read_all(offset, block_size, cache);
-	memcpy(buffer, cache, block_size);
-	return;
+	return __atomic_load_n(&data[number], __ATOMIC_ACQUIRE);
     }
-    number -= 12;
+    return __atomic_load_n(slot(number - 12), __ATOMIC_ACQUIRE);
+}
+
+Node::Pending* Node::find_pending(uint32_t number) {
+    for (auto p = pending; p != nullptr && p->number <= number; p = p->next) {
+	if (p->number == number) return p;
+    }
+    return nullptr;
+}
+
+bool Node::same_leaf(Pending* p, uint32_t number) {
+    if (p == nullptr || p->number < 12 || number < 12) return false;
     const uint32_t pc1 = block_size / sizeof(uint32_t);
-    if (number < pc1) {
-	// singly indirect block
-	uint32_t offset = (data[12] * block_size) + (number * sizeof(uint32_t));
-	ide->read_all(offset, sizeof(uint32_t), (char*) &offset);
-	offset *= block_size;
-	ide->read_all(offset, block_size, cache);
-	memcpy(buffer, cache, block_size);
+    return (p->number - 12) / pc1 == (number - 12) / pc1;
+}
+
+void Node::read_unmapped(uint32_t number, uint32_t offset, uint32_t n, char* buffer) {
+    // write-back moves blocks from "pending" to the disk with the lock held
+    LockGuard g{lock};
+    uint32_t block = physical(number);
+    if (block != 0) {
+	auto b = BufferCache::get(ide, block, block_size);
+	memcpy(buffer, &b->data[offset], n);
 	return;
     }
-    number -= pc1;
-    const uint32_t pc2 = pc1 * pc1;
-    if (number < pc2) {
-	// doubly indirect block
-	uint32_t offset = (data[13] * block_size) + (number / pc1 * sizeof(uint32_t));
-	ide->read_all(offset, sizeof(uint32_t), (char*) &offset);
-	offset *= block_size;
-	offset += number % pc1;
-	ide->read_all(offset, sizeof(uint32_t), (char*) &offset);
-	offset *= block_size;
-	ide->read_all(offset, block_size, cache);
-	memcpy(buffer, cache, block_size);
+    auto p = find_pending(number);
+    if (p != nullptr) {
+	memcpy(buffer, &p->data[offset], n);
+    } else {
+	// a hole reads as zeros
+	bzero(buffer, n);
+    }
+}
+
+Shared<Buffer> Node::get_block(uint32_t number) {
+    uint32_t block = physical(number);
+    ASSERT(block != 0);
+    return BufferCache::get(ide, block, block_size);
+}
+
+void Node::readahead(uint32_t first, uint32_t count) {
+    const uint32_t blocks = (size + block_size - 1) / block_size;
+    if (first >= blocks) return;
+    if (count > blocks - first) count = blocks - first;
+    if (count == 0) return;
+    Shared<Node> self{this};
+    Workers::execute([self, first, count] {
+	for (uint32_t i = first; i < first + count; i++) {
+	    uint32_t block = self->physical(i);
+	    if (block != 0) BufferCache::prefetch(self->ide, block, self->block_size);
+	}
+    });
+}
+
+/* Read a block from the file, through the buffer cache */
+void Node::read_block(uint32_t number, char* buffer) {
+    uint32_t block = physical(number);
+    if (block == 0) {
+	read_unmapped(number, 0, block_size, buffer);
 	return;
     }
-    number -= pc2;
-    {
-	// trebly indirect block
-	uint32_t offset = (data[14] * block_size) + (number / pc2 * sizeof(uint32_t));
-	ide->read_all(offset, sizeof(uint32_t), (char*) &offset);
-	offset *= block_size;
-	offset += (number % pc2) / pc1;
-	ide->read_all(offset, sizeof(uint32_t), (char*) &offset);
-	offset *= block_size;
-	offset += number % pc1;
-	ide->read_all(offset, sizeof(uint32_t), (char*) &offset);
-	offset *= block_size;
-	ide->read_all(offset, block_size, cache);
-	memcpy(buffer, cache, block_size);
+    auto b = BufferCache::get(ide, block, block_size);
+    memcpy(buffer, b->data, block_size);
+}
+
+void Node::read_part(uint32_t number, uint32_t offset, uint32_t n, char* buffer) {
+    ASSERT(offset + n <= block_size);
+    uint32_t block = physical(number);
+    if (block == 0) {
+	read_unmapped(number, offset, n, buffer);
 	return;
     }
+    auto b = BufferCache::get(ide, block, block_size);
+    memcpy(buffer, &b->data[offset], n);
+}
+
+void Node::read_blocks(uint32_t first, uint32_t count, char* buffer) {
+    const uint32_t sectors = block_size / ide->block_size;
+
+    // the run of uncached blocks we haven't read yet
+    uint32_t run_start = 0;      // disk block
+    uint32_t run_count = 0;
+    char* run_buffer = buffer;
+
+    for (uint32_t i = 0; i < count; i++) {
+	char* out = buffer + i * block_size;
+	uint32_t block = physical(first + i);
+	Shared<Buffer> cached;
+	if (block != 0) cached = BufferCache::lookup(ide, block, block_size);
+
+	if (run_count != 0 && (cached != nullptr || block == 0 || block != run_start + run_count)) {
+	    ide->read_blocks(run_start * sectors, run_count * sectors, run_buffer);
+	    run_count = 0;
+	}
+
+	if (block == 0) {
+	    read_unmapped(first + i, 0, block_size, out);
+	} else if (cached != nullptr) {
+	    memcpy(out, cached->data, block_size);
+	} else {
+	    if (run_count == 0) {
+		run_start = block;
+		run_buffer = out;
+	    }
+	    run_count++;
+	}
+    }
+
+    if (run_count != 0) {
+	ide->read_blocks(run_start * sectors, run_count * sectors, run_buffer);
+    }
+}
+
+void Node::get_symbol(char* buffer) {
+    ASSERT(is_symlink());
+    if (symbol == nullptr) {
+	auto it = new char[size];
+	if (size < 60) {
+	    memcpy(it, &data[0], size);
+	} else {
+	    read_all(0, size, it);
+	}
+	char* expected = nullptr;
+	if (!__atomic_compare_exchange_n(&symbol, &expected, it, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+	    // somebody else got there first
+	    delete[] it;
+	}
+    }
+    memcpy(buffer, symbol, size);
+}
+
+int32_t Node::write(uint32_t offset, uint32_t n, const char* buffer) {
+    ASSERT(!is_dir());
+    if (offset + n < offset) return -1;
+
+    uint32_t done = 0;
+    {
+	LockGuard g{lock};
+	while (done < n) {
+	    const uint32_t at = offset + done;
+	    const uint32_t number = at / block_size;
+	    const uint32_t start = at % block_size;
+	    uint32_t chunk = block_size - start;
+	    if (chunk > n - done) chunk = n - done;
+
+	    uint32_t block = physical(number);
+	    if (block != 0) {
+		// already on the disk, change it in the cache
+		auto b = BufferCache::get(ide, block, block_size);
+		memcpy(&b->data[start], &buffer[done], chunk);
+		BufferCache::mark_dirty(b);
+	    } else {
+		auto p = find_pending(number);
+		if (p == nullptr) {
+		    Pending* before = nullptr;
+		    auto q = &pending;
+		    while (*q != nullptr && (*q)->number < number) {
+			before = *q;
+			q = &(*q)->next;
+		    }
+		    // and the indirect blocks on the way to it, unless a
+		    // neighbour in the same leaf already asked for them
+		    uint32_t extra = 0;
+		    if (!same_leaf(before, number) && !same_leaf(*q, number)) extra = fs->map_blocks(number);
+		    // the disk is full
+		    if (!fs->reserve(1 + extra)) break;
+		    spare += extra;
+		    p = new Pending{number, new char[block_size], *q};
+		    bzero(p->data, block_size);
+		    *q = p;
+		}
+		memcpy(&p->data[start], &buffer[done], chunk);
+	    }
+	    done += chunk;
+	}
+	// readers look at the size last, the data is there by then
+	if (offset + done > size) __atomic_store_n(&size, offset + done, __ATOMIC_RELEASE);
+    }
+
+    if (done == 0) return (n == 0) ? 0 : -1;
+    fs->changed(this);
+    return done;
+}
+
+void Node::sync() {
+    Shared<Node> self{this};
+    fs->fsync(self);
 }
 
 // structure of directory entry
@@ -74,28 +282,141 @@ struct DirectoryEntry {
     }
 };
 
-uint32_t Node::entry_count() {
-    if (entries == 0) {
-	auto buffer = new char[block_size];
+static bool same(const char* a, const char* b, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+	if (a[i] != b[i]) return false;
+    }
+    return true;
+}
+
+// FNV-1a
+static uint32_t name_hash(const char* name, uint32_t len) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < len; i++) {
+	hash = (hash ^ (uint8_t) name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+Node::DirIndex::~DirIndex() {
+    for (uint32_t i = 0; i < nBuckets; i++) {
+	Entry* it = buckets[i];
+	while (it != nullptr) {
+	    auto next = it->next;
+	    delete[] it->name;
+	    delete it;
+	    it = next;
+	}
+    }
+    delete[] buckets;
+}
+
+void Node::DirIndex::add(uint32_t hash, uint32_t inode, const char* name, uint32_t len) {
+    auto it = new Entry{hash, inode, len, new char[len], nullptr};
+    memcpy(it->name, name, len);
+    auto& head = buckets[hash % nBuckets];
+    it->next = head;
+    // readers see all of it or none of it
+    __atomic_store_n(&head, it, __ATOMIC_RELEASE);
+    count++;
+}
+
+uint32_t Node::DirIndex::find(uint32_t hash, const char* name, uint32_t len) {
+    Entry* it = __atomic_load_n(&buckets[hash % nBuckets], __ATOMIC_ACQUIRE);
+    for (; it != nullptr; it = it->next) {
+	if (it->hash == hash && it->len == len && same(it->name, name, len)) return it->inode;
+    }
+    return 0;
+}
+
+Node::DirIndex* Node::dir_index_locked() {
+    ASSERT(is_dir());
+    auto old = index;
+    if (old != nullptr && old->count <= 2 * old->nBuckets) return old;
+
+    DirIndex* it;
+    if (old != nullptr) {
+	// crowded, move everybody to a bigger table
+	it = new DirIndex(2 * old->count);
+	for (uint32_t i = 0; i < old->nBuckets; i++) {
+	    for (DirIndex::Entry* e = old->buckets[i]; e != nullptr; e = e->next) {
+		it->add(e->hash, e->inode, e->name, e->len);
+	    }
+	}
+    } else {
+	// the first time, one pass over the directory (entries are at
+	// least 12 bytes, most names are short)
+	uint32_t guess = size / 32;
+	it = new DirIndex((guess < 16) ? 16 : guess);
 	uint32_t total_togo = size;
 	for (uint32_t i = 0; total_togo > 0; i++, total_togo -= block_size) {
-	    read_block(i, buffer);
+	    auto block = get_block(i);
 	    uint32_t togo = block_size;
-	    DirectoryEntry* entry = (DirectoryEntry*) &buffer[0];
+	    DirectoryEntry* entry = (DirectoryEntry*) block->data;
 	    while (togo > 0) {
-		if (entry->inode != 0) entries++;
+		if (entry->inode != 0) {
+		    it->add(name_hash(entry->getName(), entry->name_len), entry->inode,
+			    entry->getName(), entry->name_len);
+		}
 		togo -= entry->rec_len;
 		entry = (DirectoryEntry*) ((uintptr_t) entry + entry->rec_len);
 	    }
 	}
-	delete[] buffer;
     }
-    return entries;
+    __atomic_store_n(&index, it, __ATOMIC_RELEASE);
+    // readers that found the old one might still be in it
+    RCU::retire(old);
+    return it;
+}
+
+Node::DirIndex* Node::dir_index() {
+    auto it = __atomic_load_n(&index, __ATOMIC_ACQUIRE);
+    if (it != nullptr) return it;
+    LockGuard g{lock};
+    return dir_index_locked();
+}
+
+uint32_t Node::lookup(const char* name, uint32_t len) {
+    if (len == 0) return 0;
+    // hashing touches the whole name: if it faults, it does it here and
+    // not with interrupts off
+    const uint32_t hash = name_hash(name, len);
+    dir_index();
+    RCU::ReadGuard g{};
+    return __atomic_load_n(&index, __ATOMIC_ACQUIRE)->find(hash, name, len);
+}
+
+Shared<Node> Node::find_child(const char* name, uint32_t len) {
+    ASSERT(is_dir());
+    auto other = fs->mounted(number, name, len);
+    if (other != nullptr) return other;
+    uint32_t inode = lookup(name, len);
+    if (inode == 0) return Shared<Node>{};
+    return fs->getInode(inode);
+}
+
+Shared<Node> Node::create_child(const char* name, uint32_t len) {
+    Shared<Node> self{this};
+    return fs->add_file(self, name, len);
+}
+
+void Node::index_add(const char* name, uint32_t len, uint32_t inode) {
+    auto it = index;
+    // not built yet, the first lookup reads the new name from the disk
+    if (it == nullptr) return;
+    it->add(name_hash(name, len), inode, name, len);
+    if (it->count > 2 * it->nBuckets) dir_index_locked();
+}
+
+uint32_t Node::entry_count() {
+    dir_index();
+    RCU::ReadGuard g{};
+    return __atomic_load_n(&index, __ATOMIC_ACQUIRE)->count;
 }
 
 // Ext2
 
-// unused
+// on the disk
 struct BlockGroupDescriptor {
     uint32_t block_usage_bitmap;      // 4 bytes
     uint32_t inode_usage_bitmap;      // 8 bytes
@@ -106,9 +427,7 @@ struct BlockGroupDescriptor {
     uint16_t unused[7];               // 32 bytes
 };
 
-Shared<Node> Ext2::getInode(uint32_t inode) {
-    
-    // extract raw data into buffer
+Shared<Buffer> Ext2::inode_block(uint32_t inode, uint32_t& offset) {
     uint32_t block_group = (inode-1) / inode_count_per_group;
     ASSERT(block_group < block_group_count);
     
@@ -116,28 +435,411 @@ Shared<Node> Ext2::getInode(uint32_t inode) {
     uint32_t table_offset = bgd.inode_table * block_size;
     uint32_t index = (inode-1) % inode_count_per_group;
     uint32_t inode_offset = table_offset + (index * get_inode_size());
-    auto buffer = new char[get_inode_size()];
-    auto cnt = ide->read_all(inode_offset, get_inode_size(), buffer);
-    ASSERT(cnt >= 0);
+    offset = inode_offset % block_size;
+    return BufferCache::get(ide, inode_offset / block_size, block_size);
+}
+
+Shared<Node> Ext2::readInode(uint32_t inode) {
+    
+    // extract raw data into buffer
+    uint32_t offset;
+    auto block = inode_block(inode, offset);
+    const char* buffer = &block->data[offset];
     
     // read relevent inode fields
     auto node = Shared<Node>::make(block_size, inode);
     node->ide = ide;
+    node->fs = this;
     node->mode = *((uint16_t*) &buffer[0]);
     node->size = *((uint32_t*) &buffer[4]);
     node->link_count = *((uint16_t*) &buffer[26]);
+    node->sectors = *((uint32_t*) &buffer[28]);
     memcpy(&node->data[0], &buffer[40], sizeof(uint32_t[15]));
-    delete[] buffer;
     return node;
 }
 
-Ext2::Ext2(Shared<Ide> ide) : ide{ide} {
+void Ext2::save_inode(Borrowed<Node> node) {
+    uint32_t offset;
+    auto block = inode_block(node->number, offset);
+    char* buffer = &block->data[offset];
+    *((uint16_t*) &buffer[0]) = node->mode;
+    *((uint32_t*) &buffer[4]) = node->size;
+    *((uint16_t*) &buffer[26]) = node->link_count;
+    *((uint32_t*) &buffer[28]) = node->sectors;
+    memcpy(&buffer[40], &node->data[0], sizeof(uint32_t[15]));
+    BufferCache::mark_dirty(block);
+}
+
+// Allocation
+
+static inline bool bit(const char* map, uint32_t i) {
+    return (map[i / 8] >> (i % 8)) & 1;
+}
+
+// the first clear bit in [from,to), "to" if there isn't one
+static uint32_t first_clear(const char* map, uint32_t from, uint32_t to) {
+    uint32_t i = from;
+    while (i < to) {
+	if ((i % 8) == 0 && (uint8_t) map[i / 8] == 0xff) {
+	    i += 8;
+	    continue;
+	}
+	if (!bit(map, i)) return i;
+	i++;
+    }
+    return to;
+}
+
+void Ext2::save_super() {
+    // 1024 bytes in, whatever the block size
+    auto b = BufferCache::get(ide, 1024 / block_size, block_size);
+    char* super = &b->data[1024 % block_size];
+    *((uint32_t*) &super[12]) = free_blocks;
+    *((uint32_t*) &super[16]) = free_inodes;
+    BufferCache::mark_dirty(b);
+}
+
+void Ext2::save_group(uint32_t group) {
+    const uint32_t at = group * sizeof(BlockGroupDescriptor);
+    auto b = BufferCache::get(ide, bgdt_block + at / block_size, block_size);
+    auto it = (BlockGroupDescriptor*) &b->data[at % block_size];
+    it->unallocated_block_count = group_table[group].unallocated_block_count;
+    it->unallocated_inode_count = group_table[group].unallocated_inode_count;
+    it->directory_count = group_table[group].directory_count;
+    BufferCache::mark_dirty(b);
+}
+
+bool Ext2::reserve(uint32_t n) {
+    LockGuard g{alloc_lock};
+    if (free_blocks < reserved + n + RESERVE_SLACK) return false;
+    reserved += n;
+    return true;
+}
+
+void Ext2::unreserve(uint32_t n) {
+    LockGuard g{alloc_lock};
+    ASSERT(reserved >= n);
+    reserved -= n;
+}
+
+uint32_t Ext2::alloc_block(uint32_t goal, bool from_reserve) {
+    LockGuard g{alloc_lock};
+    if (from_reserve) {
+	ASSERT(reserved > 0);
+	reserved--;
+    } else if (free_blocks <= reserved) {
+	return 0;
+    }
+
+    // the first free block at or after the goal, in its group or the next ones
+    if (goal < first_data_block || goal >= block_count) goal = first_data_block;
+    const uint32_t goal_group = (goal - first_data_block) / block_count_per_group;
+    for (uint32_t k = 0; k < block_group_count; k++) {
+	const uint32_t group = (goal_group + k) % block_group_count;
+	auto& bgd = group_table[group];
+	if (bgd.unallocated_block_count == 0) continue;
+
+	const uint32_t base = first_data_block + group * block_count_per_group;
+	const uint32_t bits = (block_count - base < block_count_per_group) ? block_count - base : block_count_per_group;
+	const uint32_t from = (k == 0) ? goal - base : 0;
+	auto bitmap = BufferCache::get(ide, bgd.block_usage_bitmap, block_size);
+	uint32_t i = first_clear(bitmap->data, from, bits);
+	if (i == bits) {
+	    i = first_clear(bitmap->data, 0, from);
+	    if (i == from) continue;
+	}
+
+	bitmap->data[i / 8] |= 1 << (i % 8);
+	BufferCache::mark_dirty(bitmap);
+	bgd.unallocated_block_count--;
+	free_blocks--;
+	save_group(group);
+	save_super();
+	return base + i;
+    }
+    return 0;
+}
+
+uint32_t Ext2::alloc_inode(uint32_t goal_group, bool dir) {
+    LockGuard g{alloc_lock};
+    if (free_inodes == 0) return 0;
+
+    for (uint32_t k = 0; k < block_group_count; k++) {
+	const uint32_t group = (goal_group + k) % block_group_count;
+	auto& bgd = group_table[group];
+	if (bgd.unallocated_inode_count == 0) continue;
+
+	// the reserved ones are marked as used, but don't count on it
+	const uint32_t from = (group == 0) ? first_inode - 1 : 0;
+	auto bitmap = BufferCache::get(ide, bgd.inode_usage_bitmap, block_size);
+	uint32_t i = first_clear(bitmap->data, from, inode_count_per_group);
+	if (i == inode_count_per_group) continue;
+
+	bitmap->data[i / 8] |= 1 << (i % 8);
+	BufferCache::mark_dirty(bitmap);
+	bgd.unallocated_inode_count--;
+	if (dir) bgd.directory_count++;
+	free_inodes--;
+	save_group(group);
+	save_super();
+	return group * inode_count_per_group + i + 1;
+    }
+    return 0;
+}
+
+void Ext2::free_inode(uint32_t inode, bool dir) {
+    LockGuard g{alloc_lock};
+    const uint32_t group = (inode - 1) / inode_count_per_group;
+    const uint32_t i = (inode - 1) % inode_count_per_group;
+    auto& bgd = group_table[group];
+    auto bitmap = BufferCache::get(ide, bgd.inode_usage_bitmap, block_size);
+    ASSERT(bit(bitmap->data, i));
+    bitmap->data[i / 8] &= ~(1 << (i % 8));
+    BufferCache::mark_dirty(bitmap);
+    bgd.unallocated_inode_count++;
+    if (dir) bgd.directory_count--;
+    free_inodes++;
+    save_group(group);
+    save_super();
+}
+
+// The rest are called with the node's lock held
+
+uint32_t Ext2::goal(Borrowed<Node> node) {
+    if (node->goal != 0) return node->goal;
+    // the start of the inode's group
+    return first_data_block + ((node->number - 1) / inode_count_per_group) * block_count_per_group;
+}
+
+// How many indirect blocks sit between the inode and the given block
+uint32_t Ext2::map_blocks(uint32_t number) {
+    const uint32_t pc1 = block_size / sizeof(uint32_t);
+    if (number < 12) return 0;
+    number -= 12;
+    if (number < pc1) return 1;
+    number -= pc1;
+    if (number < pc1 * pc1) return 2;
+    return 3;
+}
+
+// A zeroed block (indirect or directory), allocated right away. It comes
+// out of the node's spare reservation if there's any left
+uint32_t Ext2::new_block(Borrowed<Node> node) {
+    const bool from_spare = node->spare > 0;
+    uint32_t block = alloc_block(goal(node), from_spare);
+    if (block == 0) return 0;
+    if (from_spare) node->spare--;
+    node->goal = block + 1;
+    node->sectors += block_size / 512;
+    auto b = BufferCache::create(ide, block, block_size);
+    BufferCache::mark_dirty(b);
+    return block;
+}
+
+// the index'th pointer in the given indirect block, a new indirect block
+// if it's a hole. Whoever gave the node a block reserved these too
+uint32_t Ext2::ensure(Borrowed<Node> node, uint32_t parent, uint32_t index) {
+    auto b = BufferCache::get(ide, parent, block_size);
+    auto pointers = (uint32_t*) b->data;
+    if (pointers[index] == 0) {
+	uint32_t block = new_block(node);
+	ASSERT(block != 0);
+	pointers[index] = block;
+	BufferCache::mark_dirty(b);
+    }
+    return pointers[index];
+}
+
+uint32_t Ext2::ensure_direct(Borrowed<Node> node, uint32_t index) {
+    if (node->data[index] == 0) {
+	uint32_t block = new_block(node);
+	ASSERT(block != 0);
+	node->data[index] = block;
+    }
+    return node->data[index];
+}
+
+void Ext2::set_physical(Borrowed<Node> node, uint32_t number, uint32_t block) {
+    if (number < 12) {
+	__atomic_store_n(&node->data[number], block, __ATOMIC_RELEASE);
+	return;
+    }
+    number -= 12;
+    const uint32_t pc1 = block_size / sizeof(uint32_t);
+
+    // load the leaf before we change it, then change both under the lock
+    uint32_t* slot = node->slot(number);
+    LockGuard g{node->map_lock};
+
+    uint32_t leaf = number / pc1;
+    uint32_t parent;
+    if (leaf == 0) {
+	parent = ensure_direct(node, 12);
+    } else if (leaf - 1 < pc1) {
+	parent = ensure(node, ensure_direct(node, 13), leaf - 1);
+    } else {
+	leaf -= 1 + pc1;
+	parent = ensure(node, ensure(node, ensure_direct(node, 14), leaf / pc1), leaf % pc1);
+    }
+
+    auto b = BufferCache::get(ide, parent, block_size);
+    ((uint32_t*) b->data)[number % pc1] = block;
+    BufferCache::mark_dirty(b);
+    __atomic_store_n(slot, block, __ATOMIC_RELEASE);
+}
+
+// Write-back
+
+void Ext2::changed(Node* node) {
+    if (!__atomic_exchange_n(&node->dirty, true, __ATOMIC_SEQ_CST)) {
+	auto it = new DirtyNode{Shared<Node>{node}, nullptr};
+	LockGuard g{dirty_lock};
+	it->next = dirty_nodes;
+	dirty_nodes = it;
+    }
+    // a racy look at "reserved" is good enough for a hint
+    if (reserved * block_size + BufferCache::dirty_bytes() >= WRITEBACK_BYTES) {
+	writeback.up();
+    }
+}
+
+void Ext2::flush(Borrowed<Node> node) {
+    LockGuard g{node->lock};
+    node->dirty = false;
+
+    // the pending blocks are sorted, they end up next to each other
+    while (node->pending != nullptr) {
+	auto p = node->pending;
+	uint32_t block = alloc_block(goal(node), true);
+	ASSERT(block != 0);
+	node->goal = block + 1;
+	node->sectors += block_size / 512;
+
+	// in the cache before the map points at it
+	auto b = BufferCache::create(ide, block, block_size);
+	memcpy(b->data, p->data, block_size);
+	BufferCache::mark_dirty(b);
+	set_physical(node, p->number, block);
+
+	node->pending = p->next;
+	delete[] p->data;
+	delete p;
+    }
+    // neighbours that shared a leaf asked for more than they used
+    if (node->spare != 0) {
+	unreserve(node->spare);
+	node->spare = 0;
+    }
+    save_inode(node);
+}
+
+void Ext2::sync() {
+    LockGuard g{sync_lock};
+    DirtyNode* list;
+    {
+	LockGuard g2{dirty_lock};
+	list = dirty_nodes;
+	dirty_nodes = nullptr;
+    }
+    while (list != nullptr) {
+	flush(list->node);
+	auto next = list->next;
+	delete list;
+	list = next;
+    }
+    BufferCache::sync();
+}
+
+void Ext2::fsync(Borrowed<Node> node) {
+    LockGuard g{sync_lock};
+    // it might still be on the list, flushing it again later is harmless
+    flush(node);
+    BufferCache::sync();
+}
+
+// called with inode_lock held
+Ext2::CachedNode* Ext2::findCached(uint32_t index) {
+    for (auto it = inodes[index % INODE_BUCKETS]; it != nullptr; it = it->next) {
+	if (it->node->number == index) return it;
+    }
+    return nullptr;
+}
+
+// One step of CLOCK over a hash table, called with the table's lock held.
+// Unlinks entries that are idle and haven't been referenced since the last
+// sweep until "count" is down to "limit" (or we've been around twice).
+// Returns them linked through "next", the caller deletes them after
+// letting go of the lock
+template <typename T, typename Idle>
+static T* sweep(T** buckets, uint32_t n, uint32_t& hand, uint32_t& count, uint32_t limit, Idle idle) {
+    T* victims = nullptr;
+    for (uint32_t togo = 2 * n; togo > 0 && count > limit; togo--) {
+	auto p = &buckets[hand];
+	while (*p != nullptr) {
+	    auto it = *p;
+	    if (!it->referenced && idle(it)) {
+		*p = it->next;
+		it->next = victims;
+		victims = it;
+		count--;
+	    } else {
+		it->referenced = false;
+		p = &it->next;
+	    }
+	}
+	hand = (hand + 1) % n;
+    }
+    return victims;
+}
+
+Shared<Node> Ext2::getInode(uint32_t index) {
+    {
+	ReadGuard g{inode_lock};
+	auto it = findCached(index);
+	if (it != nullptr) {
+	    it->referenced = true;
+	    return it->node;
+	}
+    }
+
+    // read it without the lock, we might lose a race and throw it away
+    auto fresh = readInode(index);
+    auto entry = new CachedNode{fresh, nullptr, true};
+    CachedNode* victims = nullptr;
+    Shared<Node> out;
+    {
+	WriteGuard g{inode_lock};
+	auto it = findCached(index);
+	if (it != nullptr) {
+	    it->referenced = true;
+	    out = it->node;
+	} else {
+	    entry->next = inodes[index % INODE_BUCKETS];
+	    inodes[index % INODE_BUCKETS] = entry;
+	    inode_count_cached++;
+	    entry = nullptr;
+	    out = fresh;
+	    // nobody can get a new reference to a node while we hold the lock
+	    victims = sweep(inodes, INODE_BUCKETS, inode_hand, inode_count_cached, INODE_CACHE_SIZE,
+		[](CachedNode* it) { return it->node.use_count() == 1; });
+	}
+    }
+    delete entry;
+    while (victims != nullptr) {
+	auto next = victims->next;
+	delete victims;
+	victims = next;
+    }
+    return out;
+}
+
+Ext2::Ext2(Shared<Ide> ide) : ide{K::move(ide)}, inodes(), inode_lock() {
 
     // Debug::printf("reading ext2 fs\n");
     
     // read superblock (sector 2)
-    auto buffer = new char[ide->block_size];
-    ide->read_block(2, buffer);
+    auto buffer = new char[this->ide->block_size];
+    this->ide->read_block(2, buffer);
 
     // extract superblock information    
     inode_count = *((uint32_t*) &buffer[0]);
@@ -148,6 +850,12 @@ Ext2::Ext2(Shared<Ide> ide) : ide{ide} {
     block_count_per_group = *((uint32_t*) &buffer[32]);
     inode_count_per_group = *((uint32_t*) &buffer[40]);
 
+    free_blocks = *((uint32_t*) &buffer[12]);
+    free_inodes = *((uint32_t*) &buffer[16]);
+    first_data_block = *((uint32_t*) &buffer[20]);
+    // revision 0 reserves the first 10 inodes, later ones say how many
+    first_inode = (*((uint32_t*) &buffer[76]) == 0) ? 11 : *((uint32_t*) &buffer[84]);
+
     // number of block groups
     block_group_count = ((inode_count-1) / inode_count_per_group) + 1;
     ASSERT(block_group_count == ((block_count-1) / block_count_per_group) + 1);
@@ -160,11 +868,12 @@ Ext2::Ext2(Shared<Ide> ide) : ide{ide} {
     delete[] buffer;
     
     // read block group descriptor table
-    uint32_t bgdt_offset = block_size * (block_size == 1024 ? 2 : 1);
+    bgdt_block = (block_size == 1024 ? 2 : 1);
+    uint32_t bgdt_offset = block_size * bgdt_block;
     uint32_t bgdt_size = block_group_count * sizeof(BlockGroupDescriptor);
 
     buffer = new char[bgdt_size];
-    ide->read_all(bgdt_offset, bgdt_size, buffer);
+    this->ide->read_all(bgdt_offset, bgdt_size, buffer);
 
     // Debug::printf("block group count = %d\n", block_group_count);
     
@@ -172,7 +881,13 @@ Ext2::Ext2(Shared<Ide> ide) : ide{ide} {
     group_table = new BGD[block_group_count];
     for (uint32_t i = 0; i < block_group_count; i++) {
 	auto bgd = &group_table[i];
-	bgd->inode_table = *((uint32_t*) &buffer[(sizeof(BlockGroupDescriptor) * i) + 8]);
+	auto disk = (BlockGroupDescriptor*) &buffer[sizeof(BlockGroupDescriptor) * i];
+	bgd->block_usage_bitmap = disk->block_usage_bitmap;
+	bgd->inode_usage_bitmap = disk->inode_usage_bitmap;
+	bgd->inode_table = disk->inode_table;
+	bgd->unallocated_block_count = disk->unallocated_block_count;
+	bgd->unallocated_inode_count = disk->unallocated_inode_count;
+	bgd->directory_count = disk->directory_count;
     }
     delete[] buffer;
 
@@ -181,6 +896,40 @@ Ext2::Ext2(Shared<Ide> ide) : ide{ide} {
     root = getInode(2);    
     // Debug::printf("root size = %d\n", root->size);
     // Debug::printf("initialized ext2\n");
+
+    // write-back, the destructor stops it
+    thread([this] {
+	while (!stopping) {
+	    writeback.down(WRITEBACK_NS);
+	    // one sync covers every kick so far
+	    while (writeback.down(0)) {}
+	    sync();
+	}
+	stopped.up();
+    });
+}
+
+Ext2::~Ext2() {
+    // one last sync on the way out, then it's gone
+    stopping = true;
+    writeback.up();
+    stopped.down();
+
+    while (mounts != nullptr) {
+	auto next = mounts->next;
+	delete[] mounts->name;
+	delete mounts;
+	mounts = next;
+    }
+    for (uint32_t i = 0; i < INODE_BUCKETS; i++) {
+	auto it = inodes[i];
+	while (it != nullptr) {
+	    auto next = it->next;
+	    delete it;
+	    it = next;
+	}
+    }
+    delete[] group_table;
 }
 
 // static bool streq(const char* lhs, const char* rhs, uint32_t len) {
@@ -190,44 +939,32 @@ Ext2::Ext2(Shared<Ide> ide) : ide{ide} {
 //     return rhs[i] == 0;
 // }
 
-Shared<Node> Ext2::find(Shared<Node> dir, const char* name) {
+Shared<Node> Ext2::find(Borrowed<Node> dir, const char* name) {
     ASSERT(dir->is_dir());
-    auto buffer = new char[block_size];
-    uint32_t total_togo = dir->size;
-    for (uint32_t i = 0; total_togo > 0; i++, total_togo -= block_size) {
-	dir->read_block(i, buffer);
-	uint32_t togo = block_size;
-	DirectoryEntry* entry = (DirectoryEntry*) &buffer[0];
-	while (togo > 0) {
-	    const char* lhs = entry->getName();
-	    uint32_t i = 0;
-	    for (; i < entry->name_len; i++)
-		if (lhs[i] != name[i]) goto next;
-	    {
-		auto node = getInode(entry->inode);
-		if (name[i] == 0) { delete[] buffer; return node; }
-		if (name[i] == '/') { delete[] buffer; return find(node, &name[i+1]); }
-	    }
-	next:
-	    togo -= entry->rec_len;
-	    entry = (DirectoryEntry*) ((uintptr_t) entry + entry->rec_len);
-	}
-    }
-    delete[] buffer;
-    return Shared<Node>{};
+    uint32_t len = 0;
+    while (name[len] != 0 && name[len] != '/') len++;
+    auto node = dir->find_child(name, len);
+    if (node == nullptr) return node;
+    if (name[len] == 0) return node;
+    return find(node, &name[len+1]);
 }
 
 static constexpr uint32_t MAX_DEPTH = 10;
 
-Shared<Node> Ext2::open(Shared<Node> dir, const char* name) {
+Shared<Node> Ext2::open(Borrowed<Node> dir, const char* name) {
+    return resolve(dir, name, false);
+}
+
+Shared<Node> Ext2::resolve(Borrowed<Node> dir, const char* name, bool dirs) {
     ASSERT(dir->is_dir());
     
-    Shared<Node> cd = dir;
+    // cd always points at dir, root or "held"
+    Borrowed<Node> cd = dir;
+    Shared<Node> held;
     Shared<Node> file;
     char* path;
     char* base;
     uint32_t depth = MAX_DEPTH;
-    auto buffer = new char[block_size];
     
     {
 	int sz = K::strlen(name);
@@ -252,35 +989,22 @@ next_link:
     if (!cd->is_dir())
 	goto fail;
 
-    // iterate through entries
-    for (uint32_t b = 0; b < (cd->size_in_bytes() / block_size); b++) {
-	cd->read_block(b, buffer);
-	uint32_t togo = block_size;
-	DirectoryEntry* entry = (DirectoryEntry*) buffer;
-
-	while (togo > 0) {
-	    const char* lhs = entry->getName();
-	    uint32_t i = 0;
-	    for (; i < entry->name_len; i++)
-		if (lhs[i] != path[i]) goto next_entry;
-	    
-	    if (path[i] == 0) {
-		file = getInode(entry->inode);
-		goto parse_file;
-	    } else if (path[i] == '/') {
-		cd = getInode(entry->inode);
-		path = &path[i+1];
-		goto next_link;
-	    }
-	    
-	next_entry:
-	    togo -= entry->rec_len;
-	    entry = (DirectoryEntry*) ((uintptr_t) entry + entry->rec_len);
+    {
+	uint32_t len = 0;
+	while (path[len] != 0 && path[len] != '/') len++;
+	auto next = cd->find_child(path, len);
+	if (next == nullptr)
+	    goto fail;
+	if (path[len] == 0) {
+	    file = K::move(next);
+	    goto parse_file;
 	}
+	held = K::move(next);
+	cd = held;
+	path = &path[len+1];
+	goto next_link;
     }
 
-    goto fail;
-
 parse_file:    
     
     delete[] base;
@@ -291,16 +1015,171 @@ parse_file:
 	file->get_symbol(base);
 	depth--;
 	goto follow_path;
-    } else if (file->is_dir()) {
+    } else if (file->is_dir() && !dirs) {
 	file = Shared<Node>{};
     }
     
-    delete[] buffer;
     return file;
     
 fail:
     
-    delete[] buffer;
     delete[] base;
     return Shared<Node>{};
 }
+
+// Adds "name" -> inode to the directory. Called with the directory's lock
+// held. Readers scan the directory without it: they see the old entries
+// or the new one, never half of it
+bool Ext2::link(Borrowed<Node> dir, const char* name, uint32_t len, uint32_t inode) {
+    ASSERT(len <= 255);
+    const uint32_t need = (8 + len + 3) & ~3;
+    const uint32_t blocks = dir->size / block_size;
+
+    for (uint32_t i = 0; i < blocks; i++) {
+	auto block = dir->get_block(i);
+	uint32_t at = 0;
+	while (at < block_size) {
+	    auto entry = (DirectoryEntry*) &block->data[at];
+	    const uint32_t used = (entry->inode == 0) ? 0 : (8 + entry->name_len + 3) & ~3;
+	    if (entry->rec_len >= used + need) {
+		if (used == 0) {
+		    // an unused entry, the name goes in before the inode
+		    entry->name_len = len;
+		    memcpy((char*) entry->getName(), name, len);
+		    __atomic_store_n(&entry->inode, inode, __ATOMIC_RELEASE);
+		} else {
+		    // the room at the end of this one, it shrinks once the new one is ready
+		    auto fresh = (DirectoryEntry*) &block->data[at + used];
+		    fresh->inode = inode;
+		    fresh->rec_len = entry->rec_len - used;
+		    fresh->name_len = len;
+		    memcpy((char*) fresh->getName(), name, len);
+		    __atomic_store_n(&entry->rec_len, (uint16_t) used, __ATOMIC_RELEASE);
+		}
+		BufferCache::mark_dirty(block);
+		return true;
+	    }
+	    at += entry->rec_len;
+	}
+    }
+
+    // no room, the directory gets another block (and the indirect blocks
+    // on the way to it)
+    const uint32_t extra = map_blocks(blocks);
+    if (!reserve(1 + extra)) return false;
+    dir->spare += 1 + extra;
+    uint32_t number = new_block(dir);
+    ASSERT(number != 0);
+    auto block = BufferCache::get(ide, number, block_size);
+    auto entry = (DirectoryEntry*) block->data;
+    entry->inode = inode;
+    entry->rec_len = block_size;
+    entry->name_len = len;
+    memcpy((char*) entry->getName(), name, len);
+    BufferCache::mark_dirty(block);
+    set_physical(dir, blocks, number);
+    unreserve(dir->spare);
+    dir->spare = 0;
+    __atomic_store_n(&dir->size, dir->size + block_size, __ATOMIC_RELEASE);
+    save_inode(dir);
+    return true;
+}
+
+Shared<Node> Ext2::create(Borrowed<Node> dir, const char* name) {
+    ASSERT(dir->is_dir());
+
+    // the last part of the path goes in the directory the rest names
+    const uint32_t n = K::strlen(name);
+    uint32_t slash = n;
+    for (uint32_t i = 0; i < n; i++) {
+	if (name[i] == '/') slash = i;
+    }
+    const char* last = (slash == n) ? name : &name[slash + 1];
+    const uint32_t len = n - (last - name);
+    if (len == 0 || len > 255) return Shared<Node>{};
+
+    Shared<Node> parent;
+    if (slash == n) {
+	parent = dir.share();
+    } else if (slash == 0) {
+	parent = root;
+    } else {
+	auto prefix = new char[slash + 1];
+	memcpy(prefix, name, slash);
+	prefix[slash] = 0;
+	parent = resolve(dir, prefix, true);
+	delete[] prefix;
+	if (parent == nullptr || !parent->is_dir()) return Shared<Node>{};
+    }
+
+    // it's there already (maybe a symlink to follow)
+    if (parent->find_child(last, len) != nullptr) return resolve(parent, last, false);
+    return parent->create_child(last, len);
+}
+
+Shared<Node> Ext2::add_file(Borrowed<Node> dir, const char* name, uint32_t len) {
+    ASSERT(dir->is_dir());
+    if (len == 0 || len > 255) return Shared<Node>{};
+    LockGuard g{dir->lock};
+
+    // somebody might have beaten us to it
+    uint32_t inode = dir->dir_index_locked()->find(name_hash(name, len), name, len);
+    if (inode != 0) return getInode(inode);
+
+    inode = alloc_inode((dir->number - 1) / inode_count_per_group, false);
+    if (inode == 0) return Shared<Node>{};
+
+    // an empty regular file, rw-r--r--
+    {
+	uint32_t offset;
+	auto block = inode_block(inode, offset);
+	char* buffer = &block->data[offset];
+	bzero(buffer, get_inode_size());
+	*((uint16_t*) &buffer[0]) = 0x81a4;
+	*((uint16_t*) &buffer[26]) = 1;
+	BufferCache::mark_dirty(block);
+    }
+
+    if (!link(dir, name, len, inode)) {
+	free_inode(inode, false);
+	return Shared<Node>{};
+    }
+    dir->index_add(name, len, inode);
+    return getInode(inode);
+}
+
+Shared<Node> Ext2::mounted(uint32_t dir, const char* name, uint32_t len) {
+    for (Mount* it = __atomic_load_n(&mounts, __ATOMIC_ACQUIRE); it != nullptr; it = it->next) {
+	if (it->dir == dir && it->len == len && same(it->name, name, len)) return it->root;
+    }
+    return Shared<Node>{};
+}
+
+bool Ext2::mount(const char* path, Shared<Node> root) {
+    const uint32_t n = K::strlen(path);
+    uint32_t slash = n;
+    for (uint32_t i = 0; i < n; i++) {
+	if (path[i] == '/') slash = i;
+    }
+    if (slash == n || slash == n - 1) return false;
+
+    Shared<Node> dir = this->root;
+    if (slash != 0) {
+	auto prefix = new char[slash + 1];
+	memcpy(prefix, path, slash);
+	prefix[slash] = 0;
+	dir = resolve(this->root, prefix, true);
+	delete[] prefix;
+	// only in our own directories
+	if (dir == nullptr || !dir->is_dir() || dir->fs != this) return false;
+    }
+
+    const uint32_t len = n - slash - 1;
+    auto it = new Mount{dir->number, len, new char[len], K::move(root), nullptr};
+    memcpy(it->name, &path[slash + 1], len);
+    Mount* head = __atomic_load_n(&mounts, __ATOMIC_ACQUIRE);
+    do {
+	it->next = head;
+    } while (!__atomic_compare_exchange_n(&mounts, &head, it, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    return true;
+}
@@ -6,19 +6,132 @@
 #include "atomic.h"
 #include "debug.h"
 #include "heap.h"
+#include "bcache.h"
+#include "rwlock.h"
+#include "blocking_lock.h"
+#include "semaphore.h"
+
+class Ext2;
 
 // A wrapper around an i-node
 class Node : public BlockIO, public Sharable<Node> { // we implement BlockIO because we
                                                      // represent data
     
     Shared<Ide> ide;     // device driver
+    Ext2* fs = nullptr;  // the file system we live in
     uint16_t mode;       // [ 4b type | 12b permissions ]
     uint16_t link_count; // number of hard links
     uint32_t size;       // size
+    uint32_t sectors;    // disk space we use (data and indirect blocks), in 512B units
     uint32_t data[15];   // store block numbers
-    uint32_t entries = 0;
-    char* cache = nullptr;
-    uint32_t cache_num = ~0;
+    char* volatile symbol = nullptr;   // a symlink's target, once somebody asked
+
+    // The block numbers past the direct ones, copied out of the indirect
+    // blocks the first time somebody needs them. "Leaf" i is the i-th
+    // indirect block that points at data (data[12] is leaf 0, then the
+    // ones under data[13], then the ones under data[14]) and fills
+    // blocks[i * pointers per block ...]. The map is a chain of segments
+    // that only grows (a file that's written past its last leaf gets a
+    // new segment), readers never see a segment move
+    struct BlockMap {
+	const uint32_t first;      // leaf
+	const uint32_t leaves;
+	volatile bool* const loaded;
+	uint32_t* const blocks;
+	BlockMap* volatile next = nullptr;
+	BlockMap(uint32_t first, uint32_t leaves, uint32_t per_leaf) :
+	    first(first), leaves(leaves), loaded(new volatile bool[leaves]()), blocks(new uint32_t[leaves * per_leaf]) {}
+	~BlockMap() {
+	    delete[] loaded;
+	    delete[] blocks;
+	    delete next;
+	}
+    };
+    static constexpr uint32_t MAP_GROWTH = 16;      // leaves, at least, in a segment added by a writer
+    BlockMap* volatile map = nullptr;
+
+    // Writers take "lock" (it also covers "pending" and the inode fields).
+    // Loading a leaf and changing a block pointer take "map_lock", always
+    // after "lock" if we need both. Readers of blocks that are on the disk
+    // and in a loaded leaf don't take either
+    BlockingLock lock{};
+    BlockingLock map_lock{};
+
+    // Delayed allocation: written blocks that don't have a disk block yet
+    // wait here (sorted by block number) until write-back gives them disk
+    // blocks, all at once and next to each other
+    struct Pending {
+	uint32_t number;
+	char* data;
+	Pending* next;
+    };
+    Pending* pending = nullptr;
+    volatile bool dirty = false;   // on the file system's list of nodes to flush
+    uint32_t goal = 0;             // where the next block we allocate should go
+    uint32_t spare = 0;            // reserved for the indirect blocks "pending" will need
+
+    // A directory's names, hashed. The first lookup builds it (one pass
+    // over the directory), Ext2::link() adds to it. Entries are only ever
+    // added: readers don't lock (they hold an RCU::ReadGuard), an entry is
+    // complete before it's linked in. Once it's crowded a table twice the
+    // size replaces it, the old one is retired and goes away once readers
+    // that might still be in it are done
+    struct DirIndex {
+	struct Entry {
+	    uint32_t hash;
+	    uint32_t inode;
+	    uint32_t len;
+	    char* name;
+	    Entry* next;
+	};
+	const uint32_t nBuckets;
+	Entry* volatile* const buckets;
+	uint32_t count = 0;
+	DirIndex(uint32_t nBuckets) :
+	    nBuckets(nBuckets), buckets(new Entry* volatile[nBuckets]()) {}
+	~DirIndex();
+	void add(uint32_t hash, uint32_t inode, const char* name, uint32_t len);
+	uint32_t find(uint32_t hash, const char* name, uint32_t len);
+    };
+    DirIndex* volatile index = nullptr;
+
+    // The index, built or grown if needed. The second one is called with
+    // "lock" held
+    DirIndex* dir_index();
+    DirIndex* dir_index_locked();
+
+    // the i-number for the first "len" characters of "name" (0 if there
+    // is none)
+    uint32_t lookup(const char* name, uint32_t len);
+
+    // the directory got a new name (called with "lock" held)
+    void index_add(const char* name, uint32_t len, uint32_t inode);
+
+    // the segment that has the given leaf (added if there isn't one)
+    BlockMap* block_map(uint32_t leaf);
+
+    // the disk block that holds the given leaf of the block map
+    uint32_t leaf_block(uint32_t leaf);
+
+    // where the map keeps the disk block for the given block (past the
+    // direct ones), loads its leaf if needed
+    uint32_t* slot(uint32_t number);
+
+    // the disk block that holds the given block of this node
+    uint32_t physical(uint32_t number);
+
+    // called with "lock" held
+    Pending* find_pending(uint32_t number);
+
+    // is "p" in the same leaf of the block map as the given block
+    bool same_leaf(Pending* p, uint32_t number);
+
+    // A block physical() says isn't on the disk: it might be waiting for
+    // write-back, or have been given a disk block since we looked
+    void read_unmapped(uint32_t number, uint32_t offset, uint32_t n, char* buffer);
+
+    // the index'th block number stored in an indirect block
+    uint32_t pointer(uint32_t block, uint32_t index);
     
 public:
 
@@ -28,7 +141,15 @@ public:
     Node(uint32_t block_size, uint32_t number) : BlockIO(block_size), number(number) {}
 
     virtual ~Node() {
-	if (cache) delete cache;
+	delete[] symbol;
+	delete map;
+	delete index;
+	while (pending != nullptr) {
+	    auto next = pending->next;
+	    delete[] pending->data;
+	    delete pending;
+	    pending = next;
+	}
     }
 
     // How many bytes does this i-node represent
@@ -43,6 +164,40 @@ public:
     // remember that block size is defined by the file system not the device
     void read_block(uint32_t number, char* buffer) override;
 
+    // Cached blocks are copied from the cache, runs of blocks that aren't
+    // cached and sit next to each other on the disk are read straight
+    // into the buffer with one device request (and stay out of the cache)
+    void read_blocks(uint32_t first, uint32_t count, char* buffer) override;
+
+    // From the buffer cache, no temporaries
+    void read_part(uint32_t number, uint32_t offset, uint32_t n, char* buffer) override;
+
+    // the given block straight from the buffer cache, no copy. Only for
+    // blocks that exist on disk (directories and symlinks don't have holes)
+    Shared<Buffer> get_block(uint32_t number);
+
+    // Starts reading the given blocks into the buffer cache in the
+    // background (on the worker pool). Blocks past the end are ignored
+    virtual void readahead(uint32_t first, uint32_t count);
+
+    // Writes n bytes at the given offset, past the end grows the file.
+    // Returns how many bytes it wrote (fewer when the disk is full) or
+    // -1 if it couldn't write any. New blocks get disk blocks later, see
+    // "pending" and Ext2::sync()
+    virtual int32_t write(uint32_t offset, uint32_t n, const char* buffer);
+
+    // Everything written to this node so far is on the disk once this
+    // returns (see Ext2::fsync)
+    virtual void sync();
+
+    // A directory's node for the first "len" characters of "name", a null
+    // reference if there's none. Other file systems mounted here win
+    virtual Shared<Node> find_child(const char* name, uint32_t len);
+
+    // Adds an empty file with that name to the directory (or returns the
+    // node that has it already). Null if there's no room
+    virtual Shared<Node> create_child(const char* name, uint32_t len);
+
     // returns the ext2 type of the node
     uint32_t get_type() {
         return mode >> 12;
@@ -70,14 +225,7 @@ public:
     //
     // The buffer needs to be at least as big as the the value
     // returned by size_in_byte()
-    void get_symbol(char* buffer) {
-	ASSERT(is_symlink());
-	if (size < 60) {
-	    memcpy(buffer, &data[0], size);
-	} else {
-	    read_all(0, size, buffer);
-	}
-    }
+    void get_symbol(char* buffer);
 
     // Returns the number of hard links to this node
     uint32_t n_links() {
@@ -87,9 +235,10 @@ public:
     // Returns the number of entries in a directory node
     //
     // Panics if not a directory
-    uint32_t entry_count();
+    virtual uint32_t entry_count();
 
     friend class Ext2;
+    friend class TmpNode;
 };
 
 
@@ -104,19 +253,113 @@ class Ext2 : public Sharable<Ext2> {
     uint32_t block_count_per_group;
     uint32_t inode_count_per_group;
     uint32_t block_group_count;
-    
+    uint32_t first_data_block;
+    uint32_t first_inode;          // the ones before it are reserved
+    uint32_t bgdt_block;           // the block group descriptor table starts here
+
     struct BGD {
-//	uint32_t block_usage_bitmap;
-//	uint32_t inode_usage_bitmap;
+	uint32_t block_usage_bitmap;
+	uint32_t inode_usage_bitmap;
 	uint32_t inode_table;
-//	uint16_t unallocated_block_count;
-//	uint16_t unallocated_inode_count;
-//	uint16_t directory_count;
+	uint16_t unallocated_block_count;
+	uint16_t unallocated_inode_count;
+	uint16_t directory_count;
 //	uint8_t unused[14];
     }* group_table;
 
+    // Allocation. The bitmaps are read and changed through the buffer
+    // cache, the counts live here and go to the superblock and the group
+    // descriptors as they change. Blocks for delayed writes (and the
+    // indirect blocks they'll need) are reserved when they're written, so
+    // write() can say the disk is full and write-back never runs out.
+    // They're allocated at write-back
+    BlockingLock alloc_lock{};
+    uint32_t free_blocks;
+    uint32_t free_inodes;
+    uint32_t reserved = 0;
+    static constexpr uint32_t RESERVE_SLACK = 16;   // never reserved, "full" leaves a little room
+
+    bool reserve(uint32_t n);
+    void unreserve(uint32_t n);
+    uint32_t alloc_block(uint32_t goal, bool reserved);
+    uint32_t alloc_inode(uint32_t group, bool dir);
+    void free_inode(uint32_t index, bool dir);
+    // called with alloc_lock held
+    void save_super();
+    void save_group(uint32_t group);
+
+    // The cached inode table block that has the given inode
+    Shared<Buffer> inode_block(uint32_t index, uint32_t& offset);
+
+    // called with the node's lock held
+    void save_inode(Borrowed<Node> node);
+    uint32_t goal(Borrowed<Node> node);
+    uint32_t map_blocks(uint32_t number);
+    uint32_t new_block(Borrowed<Node> node);
+    uint32_t ensure(Borrowed<Node> node, uint32_t parent, uint32_t index);
+    uint32_t ensure_direct(Borrowed<Node> node, uint32_t index);
+    void set_physical(Borrowed<Node> node, uint32_t number, uint32_t block);
+    bool link(Borrowed<Node> dir, const char* name, uint32_t len, uint32_t inode);
+
+    // Write-back: nodes with pending blocks or inode changes go on a list,
+    // a thread flushes them and the buffer cache every WRITEBACK_NS or as
+    // soon as there's more than WRITEBACK_BYTES waiting
+    struct DirtyNode {
+	Shared<Node> node;
+	DirtyNode* next;
+    };
+    DirtyNode* dirty_nodes = nullptr;
+    BlockingLock dirty_lock{};
+    BlockingLock sync_lock{};
+    Semaphore writeback{0};
+    volatile bool stopping = false;
+    Semaphore stopped{0};
+    static constexpr uint64_t WRITEBACK_NS = 5000000000ull;
+    static constexpr uint32_t WRITEBACK_BYTES = 256 * 1024;
+
+    void changed(Node* node);
+    void flush(Borrowed<Node> node);
+
+    // Roots of other file systems (see mount), each one stands in for a
+    // name in one of our directories. That name doesn't have to exist on
+    // the disk. Mounts are only added, lookups don't lock
+    struct Mount {
+	uint32_t dir;
+	uint32_t len;
+	char* name;
+	Shared<Node> root;
+	Mount* next;
+    };
+    Mount* volatile mounts = nullptr;
+
+    Shared<Node> mounted(uint32_t dir, const char* name, uint32_t len);
+
+    // create_child() for our directories
+    Shared<Node> add_file(Borrowed<Node> dir, const char* name, uint32_t len);
+
+    // Inodes we've read. Everybody who opens a file gets the same Node
+    // (and whatever it has cached). Past INODE_CACHE_SIZE, nodes only
+    // the cache holds are dropped in CLOCK order. Lookups share the lock,
+    // adding and dropping take it for themselves
+    struct CachedNode {
+	Shared<Node> node;
+	CachedNode* next;
+	bool referenced;       // looked up since the hand last came by
+    };
+    static constexpr uint32_t INODE_BUCKETS = 256;
+    static constexpr uint32_t INODE_CACHE_SIZE = 512;
+    CachedNode* inodes[INODE_BUCKETS];
+    uint32_t inode_count_cached = 0;
+    uint32_t inode_hand = 0;
+    BlockingRWLock inode_lock;
+
+    CachedNode* findCached(uint32_t index);
+    Shared<Node> readInode(uint32_t index);
     Shared<Node> getInode(uint32_t index);
 
+    // open(), or with "dirs" also returns directories
+    Shared<Node> resolve(Borrowed<Node> dir, const char* name, bool dirs);
+
 public:
     // The root directory for this file system
     Shared<Node> root;
@@ -124,9 +367,7 @@ public:
     // Mount an existing file system residing on the given device
     // Panics if the file system is invalid
     Ext2(Shared<Ide> ide);
-    ~Ext2() {
-	delete[] group_table;
-    }
+    ~Ext2();
 
     // Returns the block size of the file system. Doesn't have
     // to match that of the underlying device
@@ -147,9 +388,24 @@ public:
     // Returns a null reference if "name" doesn't exist in the directory
     //
     // Panics if "dir" is not a directory
-    Shared<Node> find(Shared<Node> dir, const char* name);
+    Shared<Node> find(Borrowed<Node> dir, const char* name);
+
+    Shared<Node> open(Borrowed<Node> dir, const char* name);
+
+    // Like open() but adds an empty file if the name isn't there. The
+    // directory it goes in has to exist
+    Shared<Node> create(Borrowed<Node> dir, const char* name);
+
+    // Writes everything one node has waiting (its blocks and every dirty
+    // block in the cache) and flushes the disk
+    void fsync(Borrowed<Node> node);
+
+    // The same for every node
+    void sync();
 
-    Shared<Node> open(Shared<Node> dir, const char* name);
+    // Paths through "path" (a directory of ours and a name in it) go to
+    // "root" from now on. False if the directory isn't there
+    bool mount(const char* path, Shared<Node> root);
     
     friend class Node;
 };
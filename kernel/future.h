@@ -5,31 +5,161 @@
 #include "semaphore.h"
 #include "threads.h"
 #include "shared.h"
+#include "workers.h"
+
+// A value that shows up later
+//
+//    - get() blocks until it's there, is_ready() doesn't
+//    - then(f) returns a future for f(value). f runs on the worker pool
+//      once the value is set, nobody blocks waiting for it
+//    - when_all(a, b, ...) is ready once all of them are (its value is
+//      how many there were), when_any(a, b, ...) once one of them is (its
+//      value is the position of the first one)
+//
+// Continuations are worker pool jobs: keep them short and don't make
+// them wait for other futures (see workers.h).
 
 template <typename T>
 class Future : public Sharable<Future<T>> {
     Semaphore sem;
     T value;
+    volatile bool ready;
+    InterruptSafeLock lock;
+    Workers::Job* continuations;    // run when the value is set
 public:
-    Future() : sem{0} {}
-    Future(const Future&) = delete;    
+    Future() : sem{0}, value(), ready(false), lock(), continuations(nullptr) {}
+    Future(const Future&) = delete;
+    ~Future() {
+	// never set (a child nobody waited for), these can't run any more
+	while (continuations != nullptr) {
+	    auto next = continuations->next;
+	    delete continuations;
+	    continuations = next;
+	}
+    }
     void set(T v) {
-	value = v;
+	Workers::Job* list;
+	{
+	    LockGuard g{lock};
+	    value = v;
+	    ready = true;
+	    list = continuations;
+	    continuations = nullptr;
+	}
 	sem.up();
+	while (list != nullptr) {
+	    auto next = list->next;
+	    Workers::post(list);
+	    list = next;
+	}
     }
     T get() {
 	sem.down();
 	sem.up();
 	return value;
     }
+    bool is_ready() {
+	return ready;
+    }
+
+    // Runs "work" on the worker pool once the value is set
+    template <typename W>
+    void on_ready(W work) {
+	auto job = new Workers::JobImpl<W>(work);
+	{
+	    LockGuard g{lock};
+	    if (!ready) {
+		job->next = continuations;
+		continuations = job;
+		return;
+	    }
+	}
+	Workers::post(job);
+    }
+
+    //
+    // Shared<Future<uint32_t>> size = file->then<uint32_t>([](Shared<Node> n) {
+    //     return n->size_in_bytes();
+    // });
+    //
+    template <typename Out, typename F>
+    Shared<Future<Out>> then(F f) {
+	auto out = Shared<Future<Out>>::make();
+	Shared<Future<T>> self{this};
+	on_ready([self, out, f]() mutable { out->set(f(self->value)); });
+	return out;
+    }
 };
 
+namespace gheith {
+    struct Countdown : public Sharable<Countdown> {
+	Atomic<uint32_t> remaining;
+	Atomic<uint32_t> done;
+	Shared<Future<uint32_t>> out;
+	Countdown(uint32_t n) : remaining(n), done(0), out(Shared<Future<uint32_t>>::make()) {}
+    };
+}
+
+template <typename... Ts>
+Shared<Future<uint32_t>> when_all(Shared<Future<Ts>>... futures) {
+    constexpr uint32_t n = sizeof...(Ts);
+    auto c = Shared<gheith::Countdown>::make(n);
+    if (n == 0) c->out->set(0);
+    (futures->on_ready([c, n] {
+	if (c->remaining.add_fetch(-1) == 0) c->out->set(n);
+    }), ...);
+    return c->out;
+}
+
+template <typename... Ts>
+Shared<Future<uint32_t>> when_any(Shared<Future<Ts>>... futures) {
+    static_assert(sizeof...(Ts) > 0, "when_any needs at least one future");
+    auto c = Shared<gheith::Countdown>::make(sizeof...(Ts));
+    uint32_t i = 0;
+    (futures->on_ready([c, index = i++] {
+	if (c->done.exchange(1) == 0) c->out->set(index);
+    }), ...);
+    return c->out;
+}
+
+// The same for an array of futures (waiting for a bunch of children, ...)
+template <typename T>
+Shared<Future<uint32_t>> when_all(Shared<Future<T>>* futures, uint32_t n) {
+    auto c = Shared<gheith::Countdown>::make(n);
+    if (n == 0) c->out->set(0);
+    for (uint32_t i = 0; i < n; i++) {
+	futures[i]->on_ready([c, n] {
+	    if (c->remaining.add_fetch(-1) == 0) c->out->set(n);
+	});
+    }
+    return c->out;
+}
+
+template <typename T>
+Shared<Future<uint32_t>> when_any(Shared<Future<T>>* futures, uint32_t n) {
+    ASSERT(n > 0);
+    auto c = Shared<gheith::Countdown>::make(n);
+    for (uint32_t i = 0; i < n; i++) {
+	futures[i]->on_ready([c, i] {
+	    if (c->done.exchange(1) == 0) c->out->set(i);
+	});
+    }
+    return c->out;
+}
+
+namespace Workers {
+    // Runs "work" on the worker pool, its result shows up in the future
+    template <typename Out, typename T>
+    Shared<Future<Out>> submit(T work) {
+	auto f = Shared<Future<Out>>::make();
+	execute([f, work]() mutable { f->set(work()); });
+	return f;
+    }
+}
+
 template <typename Out, typename T>
 Shared<Future<Out>> future(T work) {
-    auto f = Shared<Future<Out>>::make();
-    thread([=] { f->set(work()); });
-    return f;
+    return Workers::submit<Out>(work);
 }
 
 #endif
-
@@ -3,6 +3,8 @@
 #include "debug.h"
 #include "machine.h"
 #include "threads.h"
+#include "timer.h"
+#include "blocking_lock.h"
 
 // The drive number encodes the controller in bit 1 and the channel in bit 0
 
@@ -22,6 +24,10 @@ static inline int port(uint32_t drive) {
     return ports[controller(drive)];
 }
 
+// Both drives on a controller share its ports, one command at a time.
+// The holder can sleep while the drive is busy so it's a blocking lock
+static BlockingLock locks[2];
+
 //////////////////
 // drive status //
 //////////////////
@@ -42,6 +48,19 @@ static inline long getStatus(uint32_t drive) {
    Need to use interrupts and DMA
  */
 
+/* Called while polling the drive. The first few rounds yield, after that
+   we sleep for a jiffy so a slow drive doesn't keep us on the ready queue
+ */
+static void backoff(uint32_t& rounds) {
+    constexpr uint32_t YIELDS = 32;
+    if (rounds < YIELDS) {
+        rounds ++;
+        yield();
+    } else {
+        sleep(1);
+    }
+}
+
 static void waitForDrive(uint32_t drive) {
     uint8_t status = getStatus(drive);
     if ((status & (ERR | DF)) != 0) {
@@ -50,8 +69,9 @@ static void waitForDrive(uint32_t drive) {
     if ((status & DRDY) == 0) {
         Debug::panic("drive %x is not ready, status:%x",drive,status);
     }
+    uint32_t rounds = 0;
     while ((getStatus(drive) & BSY) != 0) {
-        yield();
+        backoff(rounds);
     }
 }
 
@@ -59,93 +79,108 @@ static uint32_t nRead = 0;
 static uint32_t nWrite = 0;
 
 void Ide::read_block(uint32_t sector, char* buffer) {
-//    Debug::printf("reading sector %d\n", sector);    
+    read_blocks(sector, 1, buffer);
+}
+
+void Ide::read_blocks(uint32_t sector, uint32_t count, char* buffer) {
+//    Debug::printf("reading %d sectors starting at %d\n", count, sector);
     uint32_t* ptr = (uint32_t*) buffer;
 
-    nRead += 1;
     int base = port(drive);
     int ch = channel(drive);
 
-    waitForDrive(drive);
+    while (count > 0) {
+        uint32_t n = (count > max_sectors) ? max_sectors : count;
+        LockGuard g{locks[controller(drive)]};
+        nRead += 1;
 
-    outb(base + 2, 1);			// sector count
-    outb(base + 3, sector >> 0);	// bits 7 .. 0
-    outb(base + 4, sector >> 8);	// bits 15 .. 8
-    outb(base + 5, sector >> 16);	// bits 23 .. 16
-    outb(base + 6, 0xE0 | (ch << 4) | ((sector >> 24) & 0xf));
-    outb(base + 7, 0x20);		// read with retry
+        waitForDrive(drive);
 
-    waitForDrive(drive);
+        outb(base + 2, n & 0xff);		// sector count (0 means 256)
+        outb(base + 3, sector >> 0);	// bits 7 .. 0
+        outb(base + 4, sector >> 8);	// bits 15 .. 8
+        outb(base + 5, sector >> 16);	// bits 23 .. 16
+        outb(base + 6, 0xE0 | (ch << 4) | ((sector >> 24) & 0xf));
+        outb(base + 7, 0x20);		// read with retry
 
-    while ((getStatus(drive) & DRQ) == 0) {
-        yield();
-    }
+        for (uint32_t s = 0; s < n; s++) {
+            // the drive raises DRQ once each sector is ready
+            waitForDrive(drive);
 
-    for (uint32_t i=0; i<block_size/sizeof(uint32_t); i++) {
-        ptr[i] = inl(base);
+            uint32_t rounds = 0;
+            while ((getStatus(drive) & DRQ) == 0) {
+                backoff(rounds);
+            }
+
+            for (uint32_t i=0; i<block_size/sizeof(uint32_t); i++) {
+                *ptr++ = inl(base);
+            }
+        }
+
+        sector += n;
+        count -= n;
     }
 }
 
-/*
-void Ide::writeSector(uint32_t sector, const void* buffer) {
+void Ide::read_part(uint32_t sector, uint32_t offset, uint32_t n, char* buffer) {
+    ASSERT(offset + n <= sector_size);
+    char temp[sector_size];
+    read_blocks(sector, 1, temp);
+    memcpy(buffer, &temp[offset], n);
+}
+
+void Ide::write_blocks(uint32_t sector, uint32_t count, const char* buffer) {
     const uint32_t* ptr = (const uint32_t*) buffer;
 
-    nWrite += 1;
     int base = port(drive);
     int ch = channel(drive);
 
-    waitForDrive(drive);
+    while (count > 0) {
+        uint32_t n = (count > max_sectors) ? max_sectors : count;
+        LockGuard g{locks[controller(drive)]};
+        nWrite += 1;
 
-    outb(base + 2, 1);			// sector count
-    outb(base + 3, sector >> 0);	// bits 7 .. 0
-    outb(base + 4, sector >> 8);	// bits 15 .. 8
-    outb(base + 5, sector >> 16);	// bits 23 .. 16
-    outb(base + 6, 0xE0 | (ch << 4) | ((sector >> 24) & 0xf));
-    outb(base + 7, 0x30);		// write
+        waitForDrive(drive);
 
-    waitForDrive(drive);
+        outb(base + 2, n & 0xff);		// sector count (0 means 256)
+        outb(base + 3, sector >> 0);	// bits 7 .. 0
+        outb(base + 4, sector >> 8);	// bits 15 .. 8
+        outb(base + 5, sector >> 16);	// bits 23 .. 16
+        outb(base + 6, 0xE0 | (ch << 4) | ((sector >> 24) & 0xf));
+        outb(base + 7, 0x30);		// write
 
-    while ((getStatus(drive) & DRQ) == 0) {
-        yield();
-    }
+        for (uint32_t s = 0; s < n; s++) {
+            // the drive raises DRQ when it wants the next sector
+            waitForDrive(drive);
 
-    for (uint32_t i=0; i<SectorSize/sizeof(uint32_t); i++) {
-        outl(base,ptr[i]);
-    }
+            uint32_t rounds = 0;
+            while ((getStatus(drive) & DRQ) == 0) {
+                backoff(rounds);
+            }
 
-    waitForDrive(drive);
-
-    //outb(base + 7, 0xE7); // flush buffers
+            for (uint32_t i=0; i<block_size/sizeof(uint32_t); i++) {
+                outl(base, *ptr++);
+            }
+        }
 
-    //waitForDrive(drive);
+        // the last sector is done when the drive stops being busy
+        waitForDrive(drive);
 
+        sector += n;
+        count -= n;
+    }
 }
-*/
-
-/*
 
-int32_t Ide::write(uint32_t offset, const void* buffer, uint32_t n) {
-    uint32_t sector = offset / SectorSize;
-    uint32_t start = offset % SectorSize;
-
-    uint32_t end = start + n;
-    if (end > SectorSize) end = SectorSize;
+void Ide::flush() {
+    int base = port(drive);
+    int ch = channel(drive);
+    LockGuard g{locks[controller(drive)]};
 
-    uint32_t count = end - start;
-    
-    if (count == SectorSize) {
-        // whole sector
-        writeSector(sector,buffer);
-    } else if (count != 0) {
-        char data[SectorSize];
-        readSector(sector,data);
-        memcpy(&data[start],buffer,count);
-        writeSector(sector,data);
-    }
-    return count;
+    waitForDrive(drive);
+    outb(base + 6, 0xE0 | (ch << 4));
+    outb(base + 7, 0xE7);		// flush write cache
+    waitForDrive(drive);
 }
-*/
-
 
 void ideStats(void) {
     Debug::printf("nRead %d\n",nRead);
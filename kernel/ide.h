@@ -18,6 +18,7 @@
 class Ide : public BlockIO {  // We are a block device
 
     constexpr static uint32_t sector_size = 512;  // older disks had a sector size of 512B
+    constexpr static uint32_t max_sectors = 256;  // the most one command can move
     
     uint32_t drive; /* 0 -> A, 1 -> B, 2 -> C, 3 -> D */
 
@@ -32,6 +33,19 @@ public:
     // buffer is big enough
     void read_block(uint32_t block_number, char* buffer) override;
 
+    // One command for up to max_sectors sectors at a time
+    void read_blocks(uint32_t first, uint32_t count, char* buffer) override;
+
+    // No heap temporaries, a sector fits on the stack
+    void read_part(uint32_t block_number, uint32_t offset, uint32_t n, char* buffer) override;
+
+    // Write "count" sectors from the buffer, one command for up to
+    // max_sectors sectors at a time
+    void write_blocks(uint32_t first, uint32_t count, const char* buffer);
+
+    // Wait until the drive has everything we wrote on the platter
+    void flush();
+
     // We lie because I'm too lazy to get the actual drive size
     // This means that we'll get QEMU errors if we try to access
     // non existent blocks.
@@ -24,7 +24,7 @@ struct Stack {
 
 PerCPU<Stack> stacks;
 
-static bool smpInitDone = false;
+bool smpInitDone = false;
 
 extern "C" uint32_t pickKernelStack(void) {
     return (uint32_t) &stacks.forCPU(smpInitDone ? SMP::me() : 0).bytes[Stack::BYTES];
@@ -8,4 +8,7 @@ extern "C" uint32_t kernelPickStack(void);
 
 extern bool onHypervisor;
 
+// SMP::me() works once this is set
+extern bool smpInitDone;
+
 #endif
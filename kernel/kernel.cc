@@ -4,11 +4,13 @@
 #include "shared.h"
 #include "threads.h"
 #include "ext2.h"
+#include "tmpfs.h"
 #include "elf.h"
 #include "vmm.h"
 #include "process.h"
 #include "barrier.h"
 #include "sys.h"
+#include "bench.h"
 
 const char* initName = "/sbin/init";
 
@@ -28,6 +30,13 @@ void kernelMain(void) {
     {
 	auto ide = Shared<Ide>::make(1);
 	auto fs = Shared<Ext2>::make(ide);	
+	// scratch files at memory speed
+	if (!fs->mount("/tmp", TmpNode::root(fs->root))) {
+	    Debug::printf("can't mount /tmp\n");
+	}
+#ifdef BENCH
+	Bench::run(fs);
+#endif
 	auto init = fs->open(fs->root, initName);
 	auto pcb = Shared<PCB>{new Process(fs)};
 	thread(pcb, [=]() mutable { SYS::exec(init, "init", 0); });
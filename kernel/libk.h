@@ -3,6 +3,7 @@
 
 #include <stdarg.h>
 #include "io.h"
+#include "stdint.h"
 
 class K {
 public:
@@ -12,6 +13,26 @@ public:
     static int isdigit(int c);
     static bool streq(const char* left, const char* right);
 
+    // 64 by 32 bit unsigned division. We don't link with libgcc so the
+    // compiler can't do it for us (no __udivdi3)
+    static inline uint64_t udiv64(uint64_t n, uint32_t d, uint32_t* rem = nullptr) {
+        uint32_t hi = n >> 32;
+        uint32_t lo = (uint32_t) n;
+        uint32_t qhi = hi / d;
+        uint32_t r = hi % d;
+        uint32_t qlo;
+        // r < d so the quotient fits in 32 bits
+        asm("divl %4" : "=a" (qlo), "=d" (r) : "a" (lo), "d" (r), "rm" (d));
+        if (rem) *rem = r;
+        return (((uint64_t) qhi) << 32) | qlo;
+    }
+
+    // std::move, hand over a Shared<T> (or anything else) without a copy
+    template <typename T>
+    static T&& move(T& it) {
+        return static_cast<T&&>(it);
+    }
+
     template <typename T>
     static T min(T v) {
         return v;
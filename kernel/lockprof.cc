@@ -0,0 +1,124 @@
+#ifdef LOCK_PROFILE
+
+#include "atomic.h"
+#include "smp.h"
+#include "config.h"
+#include "debug.h"
+#include "machine.h"
+#include "init.h"
+#include "libk.h"
+
+namespace LockProfile {
+
+    struct Entry {
+        const void* lock;
+        void* site;
+        uint32_t acquisitions;
+        uint32_t contended;
+        uint64_t waitCycles;
+        uint64_t holdCycles;
+    };
+
+    constexpr uint32_t TABLE_SIZE = 256;    // power of 2
+
+    // Only touched by the owning core with interrupts disabled
+    struct Table {
+        Entry entries[TABLE_SIZE];
+        uint32_t dropped;                   // didn't fit
+    };
+
+    static PerCPU<Table> tables;
+
+    // Locks are taken before we know how to ask which core we're on
+    static Table& myTable() {
+        return smpInitDone ? tables.mine() : tables.forCPU(0);
+    }
+
+    static Entry* find(Table& table, const void* lock, void* site) {
+        uint32_t h = (((uint32_t) lock) ^ (((uint32_t) site) * 2654435761u)) >> 8;
+        for (uint32_t i = 0; i < TABLE_SIZE; i++) {
+            auto& e = table.entries[(h + i) & (TABLE_SIZE - 1)];
+            if ((e.lock == lock) && (e.site == site)) return &e;
+            if (e.lock == nullptr) {
+                e.lock = lock;
+                e.site = site;
+                return &e;
+            }
+        }
+        table.dropped ++;
+        return nullptr;
+    }
+
+    void acquired(const void* lock, Hold& hold, uint64_t start, bool contended) {
+        uint64_t now = rdtsc();
+        void* site = __builtin_return_address(0);
+        hold.since = now;
+        hold.site = site;
+
+        bool was = Interrupts::disable();
+        auto e = find(myTable(), lock, site);
+        if (e != nullptr) {
+            e->acquisitions ++;
+            if (contended) {
+                e->contended ++;
+                e->waitCycles += now - start;
+            }
+        }
+        Interrupts::restore(was);
+    }
+
+    void released(const void* lock, Hold& hold) {
+        uint64_t now = rdtsc();
+        if (hold.site == nullptr) return;
+
+        bool was = Interrupts::disable();
+        auto e = find(myTable(), lock, hold.site);
+        if (e != nullptr) e->holdCycles += now - hold.since;
+        Interrupts::restore(was);
+    }
+
+    constexpr uint32_t TOP = 20;
+
+    void report() {
+        // Merge the per-core tables. Other cores are still running, we
+        // get a slightly fuzzy snapshot
+        static Table all;
+        uint32_t dropped = 0;
+        for (uint32_t c = 0; c < kConfig.totalProcs; c++) {
+            auto& t = tables.forCPU(c);
+            dropped += t.dropped;
+            for (uint32_t i = 0; i < TABLE_SIZE; i++) {
+                auto& e = t.entries[i];
+                if (e.lock == nullptr) continue;
+                auto m = find(all, e.lock, e.site);
+                if (m == nullptr) continue;
+                m->acquisitions += e.acquisitions;
+                m->contended += e.contended;
+                m->waitCycles += e.waitCycles;
+                m->holdCycles += e.holdCycles;
+            }
+        }
+        dropped += all.dropped;
+
+        Debug::printf("| lock profile (top %d by wait cycles, %d dropped)\n", TOP, dropped);
+        Debug::printf("|     lock       site       acquired  contended  wait(kcyc)  hold(kcyc)\n");
+        // selection sort, the table is small and we're shutting down
+        for (uint32_t n = 0; n < TOP; n++) {
+            Entry* best = nullptr;
+            for (uint32_t i = 0; i < TABLE_SIZE; i++) {
+                auto& e = all.entries[i];
+                if (e.lock == nullptr) continue;
+                if ((best == nullptr) || (e.waitCycles > best->waitCycles)) best = &e;
+            }
+            if (best == nullptr) break;
+            Debug::printf("|     0x%08x 0x%08x %9d %10d %11d %11d\n",
+                (uint32_t) best->lock, (uint32_t) best->site,
+                best->acquisitions, best->contended,
+                (uint32_t) K::udiv64(best->waitCycles, 1000),
+                (uint32_t) K::udiv64(best->holdCycles, 1000));
+            best->lock = nullptr;
+        }
+    }
+}
+
+#endif
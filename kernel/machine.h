@@ -12,6 +12,7 @@ extern "C" void outl(int port, int val);
 
 extern "C" uint64_t rdmsr(uint32_t id);
 extern "C" void wrmsr(uint32_t id, uint64_t value);
+extern "C" uint64_t rdtsc();
 
 extern "C" void vmm_on(uint32_t pd);
 extern "C" void invlpg(uint32_t va);
@@ -0,0 +1,118 @@
+#ifndef _parallel_h_
+#define _parallel_h_
+
+#include "atomic.h"
+#include "shared.h"
+#include "config.h"
+#include "threads.h"
+#include "workers.h"
+#include "barrier.h"
+
+// Data parallel loops that use every core
+//
+//   parallel_for(0, n, 64, [](uint32_t i) { ... });
+//
+//   auto total = parallel_reduce(0, n, 64, 0,
+//                                [](uint32_t i) { return f(i); },
+//                                [](uint32_t a, uint32_t b) { return a + b; });
+//
+//    - [begin,end) is cut into chunks of "grain" indices
+//    - the caller and one job per other core (see workers.h) grab chunks
+//      until there are none left
+//    - the caller returns once every chunk is done. It waits for chunks,
+//      not for the helpers: a helper that gets to run late finds nothing
+//      to do and leaves. This way a busy pool slows us down but can't
+//      deadlock us, and it's safe to call these from a job
+//    - the caller and whoever finishes the last chunk meet at a sense
+//      barrier, so the caller spins for a bit and then sleeps instead of
+//      yielding until the stragglers are done
+//    - fn and combine run concurrently on many cores. combine has to be
+//      associative and commutative (chunks finish in any order)
+
+namespace gheith {
+
+    template <typename Body>
+    struct ParallelLoop : public Sharable<ParallelLoop<Body>> {
+        const uint32_t begin;
+        const uint32_t end;
+        const uint32_t grain;
+        const uint32_t nChunks;
+        Body body;
+        Atomic<uint32_t> nextChunk;
+        Atomic<uint32_t> remaining;   // chunks that haven't finished
+        SenseBarrier done;            // the caller and the last one to finish
+
+        ParallelLoop(uint32_t begin, uint32_t end, uint32_t grain, Body body) :
+            begin(begin),
+            end(end),
+            grain(grain),
+            nChunks((end - begin + grain - 1) / grain),
+            body(body),
+            nextChunk(0),
+            remaining(nChunks),
+            done(2) {}
+
+        ParallelLoop(const ParallelLoop&) = delete;
+
+        // grab and run chunks until there are none left, true if we
+        // finished the last one
+        bool help() {
+            while (true) {
+                uint32_t chunk = nextChunk.fetch_add(1);
+                if (chunk >= nChunks) return false;
+                uint32_t from = begin + chunk * grain;
+                uint32_t to = (end - from > grain) ? from + grain : end;
+                body(from, to);
+                if (remaining.add_fetch(-1) == 0) return true;
+            }
+        }
+    };
+
+    template <typename Body>
+    void parallel_chunks(uint32_t begin, uint32_t end, uint32_t grain, Body body) {
+        if (end <= begin) return;
+        if (grain == 0) grain = 1;
+
+        auto loop = Shared<ParallelLoop<Body>>::make(begin, end, grain, body);
+
+        uint32_t helpers = kConfig.totalProcs - 1;
+        if (helpers > loop->nChunks - 1) helpers = loop->nChunks - 1;
+        for (uint32_t i = 0; i < helpers; i++) {
+            Workers::execute([loop] {
+                if (loop->help()) loop->done.sync();
+            });
+        }
+
+        // if we didn't finish the last chunk, the helper that does meets
+        // us here
+        if (!loop->help()) loop->done.sync();
+    }
+}
+
+template <typename F>
+void parallel_for(uint32_t begin, uint32_t end, uint32_t grain, F fn) {
+    gheith::parallel_chunks(begin, end, grain, [fn](uint32_t from, uint32_t to) {
+        for (uint32_t i = from; i < to; i++) fn(i);
+    });
+}
+
+template <typename T, typename F, typename C>
+T parallel_reduce(uint32_t begin, uint32_t end, uint32_t grain, T identity, F fn, C combine) {
+    T result = identity;
+    SpinLock lock{};
+
+    // Safe to capture our stack, nobody runs the body once all chunks are done
+    gheith::parallel_chunks(begin, end, grain,
+        [fn, combine, identity, &result, &lock](uint32_t from, uint32_t to) {
+            T partial = identity;
+            for (uint32_t i = from; i < to; i++) {
+                partial = combine(partial, fn(i));
+            }
+            LockGuard g{lock};
+            result = combine(result, partial);
+        });
+
+    return result;
+}
+
+#endif
@@ -5,6 +5,28 @@
 
 struct Process;
 
+// Where a thread (or a process) spent its time, in rdtsc ticks
+//    user:   running user code
+//    kernel: running kernel code (system calls, interrupts, page faults, ...)
+//    wait:   not running (ready or blocked)
+struct CpuTime {
+    uint64_t user = 0;
+    uint64_t kernel = 0;
+    uint64_t wait = 0;
+
+    void add(const CpuTime& other) {
+	user += other.user;
+	kernel += other.kernel;
+	wait += other.wait;
+    }
+};
+
+// Outlives the process, the parent reads it after waiting for us
+struct Usage : public Sharable<Usage> {
+    CpuTime self;        // filled in when the process exits
+    CpuTime children;    // the children we waited for (and theirs)
+};
+
 struct PCB : public Sharable<PCB> {
     static Atomic<uint32_t> next_id;
 
@@ -7,7 +7,7 @@
 
 namespace PhysMem {
     
-    static InterruptSafeLock lock{};
+    static InterruptSafe<MCSLock> lock{};
 
     InterruptSafeLock reflock{};
     
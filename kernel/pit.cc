@@ -4,6 +4,8 @@
 #include "idt.h"
 #include "smp.h"
 #include "threads.h"
+#include "timer.h"
+#include "rcu.h"
 
 /*
  * The old PIT runs at a fixed frequency of 1193182Hz but doesn't support
@@ -31,6 +33,7 @@ constexpr uint32_t APIT_vector = 40;
 uint32_t Pit::jiffiesPerSecond = 0;
 uint32_t Pit::apitCounter = 0;
 uint32_t Pit::jiffies = 0;
+uint32_t Pit::tscPerMicro = 0;
 
 struct PitInfo {
 };
@@ -88,6 +91,7 @@ void Pit::calibrate(uint32_t hz) {
 
     uint32_t last = inb(0x61) & 0x20;
     uint32_t changes = 0;
+    uint64_t tsc = rdtsc();   // might as well calibrate the TSC too
     // The PIT counts twice as fast when it runs in the
     // square-wave generator mode. So, the state is
     // really changing at 40Hz and we should loop
@@ -102,6 +106,7 @@ void Pit::calibrate(uint32_t hz) {
     }
     
     uint32_t diff = initial - SMP::apit_current_count.get();
+    tsc = rdtsc() - tsc;
 
     // stop the PIT
     outb(0x61,0);
@@ -110,6 +115,8 @@ void Pit::calibrate(uint32_t hz) {
     apitCounter = diff / hz;
     jiffiesPerSecond = hz;
     Debug::printf("| APIT counter=%d for %dHz\n",apitCounter,hz);
+    tscPerMicro = K::udiv64(tsc, 1000000);
+    Debug::printf("| TSC running at %uMHz\n",tscPerMicro);
 
     // Register the APIT interrupt handler
     IDT::interrupt(APIT_vector, (uint32_t)apitHandler_);
@@ -142,7 +149,14 @@ extern "C" void apitHandler(uint32_t* things) {
         Pit::jiffies ++;
     }
     SMP::eoi_reg.set(0);
+    // interrupts were enabled, this core isn't in an RCU read section
+    RCU::quiescent();
+    bool fromUser = (things[9] & 3) != 0;
+    if (fromUser) gheith::enter_kernel();
+    Timers::tick();
     auto me = gheith::activeThreads[id];
-    if ((me == nullptr) || (me->isIdle) || (me->saveArea.no_preempt)) return;
-    yield();
+    if ((me != nullptr) && !me->isIdle && !me->saveArea.no_preempt) {
+        yield();
+    }
+    if (fromUser) gheith::leave_kernel();
 }
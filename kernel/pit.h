@@ -5,6 +5,7 @@
 #include "smp.h"
 #include "atomic.h"
 #include "debug.h"
+#include "libk.h"
 
 class Thread;
 
@@ -13,11 +14,22 @@ class Pit {
     static uint32_t apitCounter;
 public:
     static uint32_t jiffies;
+    static uint32_t tscPerMicro;    // rdtsc ticks per microsecond
     static void calibrate(uint32_t hz);
     static void init();
     static uint32_t secondsToJiffies(uint32_t secs) {
         return jiffiesPerSecond * secs;
     }
+    // rounds up, a non-zero duration is at least one jiffy
+    static uint32_t nsToJiffies(uint64_t ns) {
+        if (ns == 0) return 0;
+        uint32_t nsPerJiffy = 1000000000 / jiffiesPerSecond;
+        uint64_t out = K::udiv64(ns + nsPerJiffy - 1, nsPerJiffy);
+        return (out >> 32) ? ~((uint32_t) 0) : (uint32_t) out;
+    }
+    static uint64_t tscToMicros(uint64_t tsc) {
+        return (tscPerMicro == 0) ? 0 : K::udiv64(tsc, tscPerMicro);
+    }
     static uint32_t seconds(void) {
         return jiffies / jiffiesPerSecond;
         return 0;
@@ -16,6 +16,7 @@ struct Process : public PCB {
     static constexpr uint32_t SDT_SIZE = 10;
     
     Shared<Future<int>> exit_status;
+    Shared<Usage> usage;
     Shared<Ext2> fs;
     Shared<Node> cd;
     Shared<OutputStream<char>> io;
@@ -26,6 +27,7 @@ struct Process : public PCB {
     Process(Shared<Ext2> fs) :
 	PCB(VMM::copy_kpd()),
 	exit_status(new Future<int>()),
+	usage(new Usage()),
 	fs(fs),
 	cd(fs->root),
 	io(new U8250()) {
@@ -87,6 +89,7 @@ private:
     Process(const Process& p) :
 	PCB(VMM::copy_pd((uint32_t*) p.cr3)),
 	exit_status(new Future<int>),
+	usage(new Usage()),
 	fs(p.fs),
 	cd(p.cd),
 	io(p.io),
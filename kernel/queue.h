@@ -31,6 +31,12 @@ public:
         last = t;
     }
 
+    // The first element (or nullptr), it stays in the queue
+    T* peek() {
+        LockGuard g{lock};
+        return first;
+    }
+
     T* remove() {
         LockGuard g{lock};
         if (first == nullptr) {
@@ -44,6 +50,27 @@ public:
         return it;
     }
 
+    // Removes the given element, returns false if it's not in the queue.
+    // Linear but only used on slow paths (timeouts)
+    bool remove(T* t) {
+        LockGuard g{lock};
+        T* prev = nullptr;
+        for (auto it = first; it != nullptr; prev = it, it = it->next) {
+            if (it == t) {
+                if (prev == nullptr) {
+                    first = it->next;
+                } else {
+                    prev->next = it->next;
+                }
+                if (last == it) {
+                    last = prev;
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
     T* remove_all() {
         LockGuard g{lock};
         auto it = first;
@@ -53,4 +80,75 @@ public:
     }
 };
 
+// A queue that producers add to without taking a lock
+//
+//    - add() swings "tail" to the new element with one xchg and then links
+//      the old tail to it. Until that second step lands the element is
+//      invisible to remove(). add() disables interrupts across the gap so
+//      it's a few instructions long and never spans a context switch
+//    - consumers are serialized by a lock (it's MPSC underneath). They
+//      don't contend with producers, only with each other
+//    - remove() can miss an element whose add() is halfway done and say
+//      the queue is empty. It shows up on the next try, which is what the
+//      scheduler does anyway (the monitor on "tail" wakes it up)
+//
+// Same add/remove/monitor_add/monitor_remove as Queue, no peek() or
+// remove(t): nobody can look inside without racing the producers.
+
+template <typename T, typename LockType>
+class MPSCQueue {
+    Atomic<T*> head;
+    Atomic<T*> tail;
+    LockType lock;                  // consumers only
+public:
+    MPSCQueue() : head(nullptr), tail(nullptr), lock() {}
+    MPSCQueue(const MPSCQueue&) = delete;
+
+    void monitor_add() {
+        tail.monitor_value();
+    }
+
+    void monitor_remove() {
+        head.monitor_value();
+    }
+
+    void add(T* t) {
+        t->next = nullptr;
+        Interrupts::protect([this, t] {
+            T* prev = tail.exchange(t, ACQ_REL);
+            if (prev == nullptr) {
+                head.set(t, RELEASE);
+            } else {
+                __atomic_store_n(&prev->next, t, __ATOMIC_RELEASE);
+            }
+        });
+    }
+
+    T* remove() {
+        LockGuard g{lock};
+        T* it = head.get(ACQUIRE);
+        if (it == nullptr) {
+            return nullptr;
+        }
+        T* next = __atomic_load_n(&it->next, __ATOMIC_ACQUIRE);
+        if (next == nullptr) {
+            // the last one, unless somebody is adding behind it right now
+            T* expected = it;
+            if (tail.compare_exchange(expected, nullptr, ACQ_REL)) {
+                // a producer that found the queue empty might have set head
+                // already, it wins
+                expected = it;
+                head.compare_exchange(expected, nullptr, ACQ_REL);
+                return it;
+            }
+            // the producer has interrupts disabled, it won't be long
+            while ((next = __atomic_load_n(&it->next, __ATOMIC_ACQUIRE)) == nullptr) {
+                pause();
+            }
+        }
+        head.set(next, RELAXED);
+        return it;
+    }
+};
+
 #endif
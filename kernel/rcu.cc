@@ -0,0 +1,64 @@
+#include "rcu.h"
+#include "config.h"
+#include "queue.h"
+#include "semaphore.h"
+#include "threads.h"
+#include "timer.h"
+
+namespace RCU {
+
+    PerCPU<Counter> quiescentStates;
+
+    static Queue<Callback,InterruptSafeLock> pending{};
+    static Semaphore nPending{0};
+
+    void post(Callback* cb) {
+        pending.add(cb);
+        nPending.up();
+    }
+
+    void synchronize() {
+        ASSERT(!Interrupts::isDisabled());
+
+        uint32_t seen[MAX_PROCS];
+        for (uint32_t i = 0; i < kConfig.totalProcs; i++) {
+            seen[i] = quiescentStates.forCPU(i).count;
+        }
+        // every core ticks at least once a jiffy, we're never far off
+        for (uint32_t i = 0; i < kConfig.totalProcs; i++) {
+            while (quiescentStates.forCPU(i).count == seen[i]) {
+                sleep(1000000);
+            }
+        }
+    }
+
+    void init() {
+        thread([] {
+            while (true) {
+                // one grace period for everything that's queued up
+                nPending.down();
+                uint32_t n = 1;
+                while (nPending.down(0)) n++;
+
+                Callback* batch = nullptr;
+                Callback* last = nullptr;
+                for (uint32_t i = 0; i < n; i++) {
+                    auto cb = pending.remove();
+                    ASSERT(cb != nullptr);
+                    if (last == nullptr) batch = cb; else last->next = cb;
+                    last = cb;
+                }
+                last->next = nullptr;
+
+                synchronize();
+
+                while (batch != nullptr) {
+                    auto next = batch->next;
+                    batch->doYourThing();
+                    delete batch;
+                    batch = next;
+                }
+            }
+        });
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef _rcu_h_
+#define _rcu_h_
+
+#include "stdint.h"
+#include "atomic.h"
+#include "smp.h"
+
+// Read-copy-update style reclamation
+//
+//    - readers run with interrupts disabled (RCU::ReadGuard) so they can't
+//      be preempted or block. A core that switches threads or takes an
+//      interrupt isn't in a read section: that's a quiescent state
+//    - writers publish a new version (RCU::Pointer::publish) and hand the
+//      old one to RCU::retire/RCU::defer
+//    - deferred work runs on the RCU thread once every core has gone
+//      through a quiescent state, i.e. once every reader that might have
+//      seen the old version is done with it (a grace period)
+//
+// Readers don't write to shared memory at all. Don't block, yield or
+// call defer inside a read section.
+
+namespace RCU {
+
+    struct Counter {
+        volatile uint32_t count = 0;
+        char pad[60];                  // one cache line per core
+    };
+
+    extern PerCPU<Counter> quiescentStates;
+
+    // Called with interrupts disabled: context switches, APIT interrupts
+    inline void quiescent() {
+        auto& it = quiescentStates.mine();
+        it.count = it.count + 1;
+    }
+
+    class ReadGuard {
+        const bool was;
+    public:
+        inline ReadGuard() : was(Interrupts::disable()) {}
+        ReadGuard(const ReadGuard&) = delete;
+        inline ~ReadGuard() {
+            Interrupts::restore(was);
+        }
+    };
+
+    // A pointer that readers follow without taking a reference
+    template <typename T>
+    class Pointer {
+        T* volatile ptr;
+    public:
+        Pointer(T* ptr = nullptr) : ptr(ptr) {}
+        Pointer(const Pointer&) = delete;
+
+        // only while holding a ReadGuard (or the writer's lock)
+        T* read() const {
+            return __atomic_load_n(&ptr, __ATOMIC_ACQUIRE);
+        }
+
+        // the contents have to be in place before the pointer is visible.
+        // Returns the old value, retire it when you're done with it
+        T* publish(T* v) {
+            return __atomic_exchange_n(&ptr, v, __ATOMIC_ACQ_REL);
+        }
+    };
+
+    struct Callback {
+        Callback* next = nullptr;
+        virtual ~Callback() {}
+        virtual void doYourThing() = 0;
+    };
+
+    template <typename F>
+    struct CallbackImpl : public Callback {
+        F f;
+        CallbackImpl(F f) : f(f) {}
+        void doYourThing() override {
+            f();
+        }
+    };
+
+    // Called once, by threadsInit
+    extern void init();
+
+    extern void post(Callback* cb);
+
+    // Run "f" (in a thread, interrupts enabled) after a grace period
+    template <typename F>
+    void defer(F f) {
+        post(new CallbackImpl<F>(f));
+    }
+
+    // Delete "p" after a grace period
+    template <typename T>
+    void retire(T* p) {
+        if (p != nullptr) defer([p] { delete p; });
+    }
+
+    // Block until every read section that's running now is done
+    extern void synchronize();
+}
+
+#endif
@@ -0,0 +1,204 @@
+#ifndef _rwlock_h_
+#define _rwlock_h_
+
+#include "stdint.h"
+#include "atomic.h"
+#include "smp.h"
+#include "condition.h"
+#include "blocking_lock.h"
+
+// Reader-writer locks for read-mostly structures
+//
+//    - readers count themselves on their own core's counter (in its own
+//      cache line) so they don't fight over a shared word. A reader can
+//      move to another core while it holds the lock, so lockRead returns
+//      the counter it bumped (a Reader) and the reader hands it back to
+//      unlockRead. Writers only look at the sum
+//    - writers are serialized by a regular lock, then wait for the sum
+//      to drop to zero
+//    - RWPolicy::PreferWriters: new readers stay out as soon as a writer
+//      shows up. PreferReaders: readers only stay out while a writer holds
+//      the lock (writers can starve)
+//
+// SpinRWLock spins, BlockingRWLock blocks (not from idle threads or with
+// interrupts disabled). Both have lockRead/unlockRead/lockWrite/unlockWrite
+// and the ReadGuard/WriteGuard helpers work with either (or with anything
+// else that has a Reader type and the same four calls).
+
+enum class RWPolicy {
+    PreferWriters,
+    PreferReaders
+};
+
+namespace gheith {
+
+    class ReaderCounts {
+        struct Slot {
+            Atomic<int32_t> count{0};
+            char pad[60];              // one cache line per core
+        };
+        PerCPU<Slot> slots;
+    public:
+        using Reader = Atomic<int32_t>*;
+
+        // we might be on another core by the time we leave, look it up once
+        Reader enter() {
+            Reader it = &slots.mine().count;
+            it->add_fetch(1);
+            return it;
+        }
+        void leave(Reader it) {
+            it->add_fetch(-1);
+        }
+        int32_t sum() {
+            int32_t out = 0;
+            for (uint32_t i = 0; i < kConfig.totalProcs; i++) {
+                out += slots.forCPU(i).count.get();
+            }
+            return out;
+        }
+    };
+
+}
+
+class SpinRWLock {
+    gheith::ReaderCounts readers;
+    TicketLock writer;
+    Atomic<uint32_t> waitingWriters;    // want the lock or have it
+    Atomic<uint32_t> active;            // a writer has the lock (or is about to)
+    const RWPolicy policy;
+
+    bool closed() {
+        return (policy == RWPolicy::PreferWriters) ? waitingWriters.get() != 0 : active.get() != 0;
+    }
+public:
+    SpinRWLock(RWPolicy policy = RWPolicy::PreferWriters) :
+        readers(), writer(), waitingWriters(0), active(0), policy(policy) {}
+
+    SpinRWLock(const SpinRWLock&) = delete;
+
+    using Reader = gheith::ReaderCounts::Reader;
+
+    Reader lockRead() {
+        while (true) {
+            while (closed()) iAmStuckInALoop(false);
+            auto me = readers.enter();
+            // pairs with the writer announcing itself before it counts us
+            if (!closed()) return me;
+            readers.leave(me);
+        }
+    }
+
+    void unlockRead(Reader me) {
+        readers.leave(me);
+    }
+
+    void lockWrite() {
+        waitingWriters.add_fetch(1);
+        writer.lock();
+        while (true) {
+            active.set(1);
+            if (readers.sum() == 0) return;
+            if (policy == RWPolicy::PreferReaders) active.set(0);
+            while (readers.sum() != 0) iAmStuckInALoop(false);
+        }
+    }
+
+    void unlockWrite() {
+        active.set(0);
+        writer.unlock();
+        waitingWriters.add_fetch(-1);
+    }
+};
+
+class BlockingRWLock {
+    gheith::ReaderCounts readers;
+    BlockingLock writer;
+    Atomic<uint32_t> waitingWriters;
+    Atomic<uint32_t> active;
+    const RWPolicy policy;
+    InterruptSafeLock guard;
+    Condition cv;                       // readers wait for the door, writers for the readers
+
+    bool closed() {
+        return (policy == RWPolicy::PreferWriters) ? waitingWriters.get() != 0 : active.get() != 0;
+    }
+
+    void notify() {
+        LockGuard g{guard};
+        cv.notifyAll();
+    }
+public:
+    BlockingRWLock(RWPolicy policy = RWPolicy::PreferWriters) :
+        readers(), writer(), waitingWriters(0), active(0), policy(policy), guard(), cv(guard) {}
+
+    BlockingRWLock(const BlockingRWLock&) = delete;
+
+    using Reader = gheith::ReaderCounts::Reader;
+
+    Reader lockRead() {
+        while (true) {
+            if (closed()) {
+                LockGuard g{guard};
+                while (closed()) cv.wait();
+            }
+            auto me = readers.enter();
+            if (!closed()) return me;
+            readers.leave(me);
+            // the writer might be waiting for us
+            notify();
+        }
+    }
+
+    void unlockRead(Reader me) {
+        readers.leave(me);
+        if (waitingWriters.get() != 0) notify();
+    }
+
+    void lockWrite() {
+        waitingWriters.add_fetch(1);
+        writer.lock();
+        LockGuard g{guard};
+        while (true) {
+            active.set(1);
+            if (readers.sum() == 0) return;
+            if (policy == RWPolicy::PreferReaders) {
+                active.set(0);
+                cv.notifyAll();
+            }
+            cv.wait();
+        }
+    }
+
+    void unlockWrite() {
+        active.set(0);
+        waitingWriters.add_fetch(-1);
+        writer.unlock();
+        notify();
+    }
+};
+
+template <typename T>
+class ReadGuard {
+    T& it;
+    typename T::Reader me;
+public:
+    inline ReadGuard(T& it): it(it), me(it.lockRead()) {}
+    inline ~ReadGuard() {
+        it.unlockRead(me);
+    }
+};
+
+template <typename T>
+class WriteGuard {
+    T& it;
+public:
+    inline WriteGuard(T& it): it(it) {
+        it.lockWrite();
+    }
+    inline ~WriteGuard() {
+        it.unlockWrite();
+    }
+};
+
+#endif
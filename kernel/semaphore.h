@@ -5,6 +5,8 @@
 #include "atomic.h"
 #include "queue.h"
 #include "threads.h"
+#include "timer.h"
+#include "pit.h"
 
 class Semaphore {
     uint64_t volatile count;
@@ -57,6 +59,60 @@ public:
         });
     }
 
+    // Like down() but gives up after (at least) "ns" nanoseconds
+    //
+    // returns true if we decremented the count, false if we timed out
+    bool down(uint64_t ns) {
+        using namespace gheith;
+
+        lock.lock();
+        if (count > 0) {
+            count--;
+            lock.unlock();
+            return true;
+        }
+        lock.unlock();
+
+        uint32_t ticks = Pit::nsToJiffies(ns);
+        if (ticks == 0) return false;
+
+        TCB* volatile waiter = nullptr;
+        volatile bool timed_out = false;
+
+        // Whoever removes us from the queue (up or the timer) gets to schedule us
+        auto timeout = Timers::timer([this, &waiter, &timed_out] {
+            lock.lock();
+            bool found = waiting.remove(waiter);
+            lock.unlock();
+            if (found) {
+                timed_out = true;
+                schedule(waiter);
+            }
+        });
+
+        block(BlockOption::MustBlock,[this, &waiter, &timeout, ticks](TCB* me) {
+            ASSERT(!me->isIdle);
+
+            lock.lock();
+
+            if (count > 0) {
+                count--;
+                lock.unlock();
+                schedule(me);
+            } else {
+                waiter = me;
+                waiting.add(me);
+                // armed while holding the lock, it can't fire before we're in the queue
+                Timers::arm(&timeout, ticks);
+                lock.unlock();
+            }
+        });
+
+        // either it fired or we make sure it never will
+        Timers::cancel(&timeout);
+        return !timed_out;
+    }
+
     void up() {
         using namespace gheith;
 
@@ -3,13 +3,20 @@
 
 #include "atomic.h"
 
+template <typename T>
+class Borrowed;
+
 template <typename T>
 class Shared {
 
+    friend class Borrowed<T>;
+
     T* ptr;
     
     void reset() {
-	if (ptr && ptr->ref_count.add_fetch(-1) == 0)
+	// release our writes to the object, acquire everybody else's if
+	// we're the last one out
+	if (ptr && ptr->ref_count.add_fetch(-1, ACQ_REL) == 0)
 	    delete ptr;
 	ptr = nullptr;
     }
@@ -17,7 +24,7 @@ class Shared {
 public:
 
     explicit Shared(T* it) : ptr{it} {
-	if (ptr) ptr->ref_count.add_fetch(1);
+	if (ptr) ptr->ref_count.add_fetch(1, RELAXED);
     }
 
     //
@@ -32,7 +39,7 @@ public:
     // return c;
     //
     Shared(const Shared& rhs) : ptr{rhs.ptr} {
-	if (ptr) ptr->ref_count.add_fetch(1);
+	if (ptr) ptr->ref_count.add_fetch(1, RELAXED);
     }
 
     //
@@ -55,7 +62,7 @@ public:
     // d = new Thing{};
     Shared<T>& operator=(T* rhs) {
 	reset();
-	if ((ptr = rhs)) ptr->ref_count.add_fetch(1);
+	if ((ptr = rhs)) ptr->ref_count.add_fetch(1, RELAXED);
         return *this;
     }
 
@@ -64,7 +71,7 @@ public:
     Shared<T>& operator=(const Shared<T>& rhs) {
 	if (&rhs == this) return *this;
 	reset();
-	if ((ptr = rhs.ptr)) ptr->ref_count.add_fetch(1);
+	if ((ptr = rhs.ptr)) ptr->ref_count.add_fetch(1, RELAXED);
         return *this;
     }
 
@@ -103,6 +110,42 @@ public:
     }
 };
 
+// A reference that doesn't own anything: copying it is free. Use it for
+// arguments when somebody up the call chain holds a Shared<T> that
+// outlives the call (the current thread's pcb, a file system's root, a
+// local variable, ...). share() makes a real reference if you need to
+// keep one around.
+template <typename T>
+class Borrowed {
+    T* ptr;
+public:
+    Borrowed(const Shared<T>& it) : ptr{it.ptr} {}
+
+    T* operator -> () const {
+        return ptr;
+    }
+
+    bool operator==(const Borrowed<T>& rhs) const {
+        return ptr == rhs.ptr;
+    }
+
+    bool operator!=(const Borrowed<T>& rhs) const {
+        return ptr != rhs.ptr;
+    }
+
+    bool operator==(T* rhs) const {
+        return ptr == rhs;
+    }
+
+    bool operator!=(T* rhs) const {
+        return ptr != rhs;
+    }
+
+    Shared<T> share() const {
+        return Shared<T>{ptr};
+    }
+};
+
 template<class Derived>
 class Sharable {
     friend class Shared<Derived>;
@@ -9,42 +9,107 @@
 #include "descriptor.h"
 #include "elf.h"
 #include "libk.h"
+#include "timer.h"
+#include "pit.h"
+#include "bcache.h"
+#include "blocking_lock.h"
 
 using namespace Descriptor;
 
 class FileDescriptor : public FD {
     Shared<Node> node;
+    BlockingLock lock;           // forked processes share the offset
     uint32_t offset = 0;
+
+    // Readahead: a read that starts where the last one ended is
+    // sequential. While the reader stays sequential we keep "window"
+    // blocks read ahead of it, starting small and doubling every time we
+    // top it up. A read anywhere else turns it off until the reader is
+    // sequential again
+    static constexpr uint32_t MIN_WINDOW = 4;
+    static constexpr uint32_t MAX_WINDOW = 64;
+    uint32_t expected = 0;       // where a sequential read starts
+    uint32_t window = 0;         // in blocks, 0 => not sequential
+    uint32_t ahead = 0;          // blocks before this one were asked for
+
+    void readahead() {
+	const uint32_t bs = node->block_size;
+	const uint32_t next = (offset + bs - 1) / bs;   // the first block we haven't read
+	if (ahead < next) ahead = next;
+	// top up once the reader is half way through what we asked for
+	if (ahead - next > window / 2) return;
+	window = (window * 2 > MAX_WINDOW) ? MAX_WINDOW : window * 2;
+	node->readahead(ahead, next + window - ahead);
+	ahead = next + window;
+    }
 public:
-    FileDescriptor(Shared<Node> node) : node{node} {}
+    FileDescriptor(Shared<Node> node) : node{K::move(node)}, lock() {}
     
     int len() override {
 	return node->size_in_bytes();
     }
 
     int read(char* buffer, int len) override {
+	LockGuard g{lock};
 	if (offset > node->size_in_bytes())
 	    return -1;
+	if (offset != expected) {
+	    window = 0;
+	    ahead = 0;
+	} else if (window == 0) {
+	    window = MIN_WINDOW / 2;
+	}
 	auto cnt = node->read_all(offset, len, buffer);
 	offset += cnt;
+	expected = offset;
+	if (window != 0 && cnt > 0) readahead();
 	return cnt;	
     }
 
     int seek(int offset) override {
+	LockGuard g{lock};
 	return this->offset = offset;
     }
+
+    int write(char* buffer, int len) override {
+	if (len < 0) return -1;
+	LockGuard g{lock};
+	auto cnt = node->write(offset, len, buffer);
+	if (cnt > 0) {
+	    offset += cnt;
+	    // our own writes don't make the next read random
+	    expected = offset;
+	}
+	return cnt;
+    }
+
+    int sync() override {
+	node->sync();
+	return 0;
+    }
 };
 
 class ProcessDescriptor : public PD {
     Shared<Future<int>> exit_status;
+    Shared<Usage> child;
+    Shared<Usage> parent;
 public:
-    ProcessDescriptor(Shared<Future<int>> exit_status) :
-	exit_status{exit_status} {}
+    ProcessDescriptor(Shared<Future<int>> exit_status,
+		      Shared<Usage> child,
+		      Shared<Usage> parent) :
+	exit_status{K::move(exit_status)}, child{K::move(child)}, parent{K::move(parent)} {}
     
     int wait(uint32_t* status) override {
 	*status = exit_status->get();
+	// the child is gone, its time (and its children's) is ours now
+	parent->children.add(child->self);
+	parent->children.add(child->children);
 	return 0;
     }
+
+    Shared<Future<int>> done() override {
+	return exit_status;
+    }
 };
 
 class SemaphoreDescriptor : public SD {
@@ -63,6 +128,12 @@ public:
     }
 };
 
+// Record the process' CPU time and let the parent know we're done
+static void terminate(Process* proc, int status) {
+    proc->usage->self.add(gheith::cpu_time());
+    proc->exit_status->set(status);
+}
+
 namespace SYS {
 
     inline bool check_range(uint32_t start, uint32_t size) {
@@ -74,7 +145,8 @@ namespace SYS {
 	    (upper <= kConfig.ioAPIC    || lower >= kConfig.ioAPIC+4096);
     }
     
-#define GEN(fun) int fun(Shared<PCB>& pcb, uint32_t* stack)
+// pcb is borrowed from the calling thread, it outlives the call
+#define GEN(fun) int fun(Borrowed<PCB> pcb, uint32_t* stack)
 
     inline uint32_t* getargs(uint32_t* stack) {
 	return (uint32_t*) stack[3] + 1;
@@ -82,8 +154,7 @@ namespace SYS {
 
     GEN(exit) {
 	auto args = getargs(stack);
-	pcb->process()->exit_status->set(args[0]);
-	pcb.~Shared<PCB>();
+	terminate(pcb->process(), args[0]);
 	stop();
 	return -1;
     }
@@ -100,9 +171,14 @@ namespace SYS {
 			 auto p = pcb->process()->clone();
 			 uint32_t pc = stack[0];
 			 uint32_t esp = stack[3];
-			 thread(p, [=] { switchToUser(pc, esp, 0); });
+			 thread(p, [=] {
+				     gheith::leave_kernel();
+				     switchToUser(pc, esp, 0);
+				 });
 			 return Shared<PD>{
-			     new ProcessDescriptor{p->process()->exit_status}};
+			     new ProcessDescriptor{p->process()->exit_status,
+						   p->process()->usage,
+						   pcb->process()->usage}};
 		     });
     }
 
@@ -128,7 +204,8 @@ namespace SYS {
     }
 
     GEN(shutdown) {
-	pcb.~Shared<PCB>();
+	// whatever write-back hasn't gotten to yet
+	pcb->process()->fs->sync();
 	Debug::shutdown();	
 	return -1;
     }
@@ -151,7 +228,9 @@ namespace SYS {
 	auto args = getargs(stack);
 	auto proc = pcb->process();
 	auto fs = proc->fs;
-	Shared<Node> file = fs->open(proc->cd, (const char*) args[0]);
+	Shared<Node> file = (args[1] & O_CREAT) ?
+	    fs->create(proc->cd, (const char*) args[0]) :
+	    fs->open(proc->cd, (const char*) args[0]);
 	if (file == nullptr) return -1;
 	return proc->set_fd([=] { return Shared<FD>{new FileDescriptor{file}}; });
     }
@@ -172,19 +251,64 @@ namespace SYS {
 	return pcb->process()->get_fd(args[0])->seek((int) args[1]);
     }
 
+    GEN(sleep) {
+	auto args = getargs(stack);
+	::sleep(((uint64_t) args[0]) * 1000000);
+	return 0;
+    }
+
+    GEN(rusage) {
+	auto args = getargs(stack);
+	if (!check_range(args[1], sizeof(uint64_t) * 3)) return -1;
+	auto proc = pcb->process();
+	CpuTime time;
+	switch (args[0]) {
+	case 0:
+	    // the threads that finished already plus the one asking
+	    time = proc->usage->self;
+	    time.add(gheith::cpu_time());
+	    break;
+	case 1:
+	    time = proc->usage->children;
+	    break;
+	default:
+	    return -1;
+	}
+	uint64_t* out = (uint64_t*) args[1];
+	out[0] = Pit::tscToMicros(time.user);
+	out[1] = Pit::tscToMicros(time.kernel);
+	out[2] = Pit::tscToMicros(time.wait);
+	return 0;
+    }
+
+    GEN(cachestat) {
+	auto args = getargs(stack);
+	if (!check_range(args[0], sizeof(BufferCache::Stats))) return -1;
+	*((BufferCache::Stats*) args[0]) = BufferCache::stats();
+	return 0;
+    }
+
+    GEN(fsync) {
+	auto args = getargs(stack);
+	return pcb->process()->get_fd(args[0])->sync();
+    }
+
 #undef GEN
 }
 
-typedef int (*syscall)(Shared<PCB>&, uint32_t*);
+typedef int (*syscall)(Borrowed<PCB>, uint32_t*);
 syscall* syscall_table;
 
-static constexpr uint32_t NUM_SYSCALLS = 14;
+static constexpr uint32_t NUM_SYSCALLS = 18;
 
 
 extern "C" int sysHandler(uint32_t num, uint32_t stack) {
     if (num >= NUM_SYSCALLS) return -1;
-    auto pcb = gheith::current()->pcb;
-    return syscall_table[num](pcb, (uint32_t*) stack);
+    bool fromUser = (((uint32_t*) stack)[1] & 3) != 0;
+    if (fromUser) gheith::enter_kernel();
+    int out = syscall_table[num](gheith::current()->pcb, (uint32_t*) stack);
+    if (fromUser) gheith::leave_kernel();
+    return out;
 }   
 
 static uint32_t user_stack;
@@ -207,6 +331,10 @@ void SYS::init(void) {
     syscall_table[11] = len;
     syscall_table[12] = read;
     syscall_table[13] = seek;
+    syscall_table[14] = sleep;
+    syscall_table[15] = rusage;
+    syscall_table[16] = cachestat;
+    syscall_table[17] = fsync;
     
     user_stack = (kConfig.localAPIC < kConfig.ioAPIC) ?
 	kConfig.localAPIC :
@@ -216,7 +344,7 @@ void SYS::init(void) {
     IDT::trap(48,(uint32_t)sysHandler_,3);
 }
 
-int exec(Shared<PCB>& pcb,
+int exec(Borrowed<PCB> pcb,
 	 Shared<Node>& file,
 	 uint32_t argc,
 	 const char** argv,
@@ -253,13 +381,13 @@ int exec(Shared<PCB>& pcb,
     ((uint32_t*) esp)[-1] = esp;
 
     delete[] buffer;
-    pcb.~Shared<PCB>();
     file.~Shared<Node>();
+    gheith::leave_kernel();
     switchToUser(entry, esp-8, 0);
     return -1;    
 }
 
-int SYS::exec(Shared<PCB>& pcb, Shared<Node>& file, const char** argv) {
+int SYS::exec(Borrowed<PCB> pcb, Shared<Node>& file, const char** argv) {
     uint32_t argc = 0;
     uint32_t sz = 0;
     for (;; argc++) {
@@ -271,14 +399,11 @@ int SYS::exec(Shared<PCB>& pcb, Shared<Node>& file, const char** argv) {
 }
 
 int SYS::exec(Shared<Node>& file, const char* arg, ...) {
-    auto pcb = gheith::current()->pcb;
-    return exec(pcb, file, &arg);
+    return exec(gheith::current()->pcb, file, &arg);
 }
 
 int SYS::exit(int status) {
-    auto pcb = [] { return gheith::current()->pcb; }();
-    pcb->process()->exit_status->set(status);
-    pcb.~Shared<PCB>();
+    terminate(gheith::current()->pcb->process(), status);
     stop();
     return -1;
 }
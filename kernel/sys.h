@@ -5,8 +5,11 @@
 #include "ext2.h"
 
 namespace SYS {
+    // open() flags, the same bit Linux uses
+    constexpr uint32_t O_CREAT = 0x40;
+
     void init(void);
-    int exec(Shared<PCB>&, Shared<Node>&, const char**);
+    int exec(Borrowed<PCB>, Shared<Node>&, const char**);
     int exec(Shared<Node>&, const char*, ...);
     int exit(int status);
 };
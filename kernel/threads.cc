@@ -6,6 +6,7 @@
 
 #include "threads.h"
 #include "condition.h"
+#include "workers.h"
 
 
 namespace gheith {
@@ -14,8 +15,23 @@ namespace gheith {
     TCB** activeThreads;
     TCB** idleThreads;
 
-    Queue<TCB,InterruptSafeLock> readyQ{};
-    Queue<TCB,InterruptSafeLock> zombies{};
+    MPSCQueue<TCB,InterruptSafe<TicketLock>> readyQ{};
+
+    // What's left of a thread once it's done with its chunk
+    struct Chunk {
+        Chunk* next;
+    };
+
+    struct FreeChunks {
+        Chunk* first = nullptr;
+        uint32_t count = 0;
+    };
+
+    // Only touched by the owning core with interrupts disabled
+    static PerCPU<FreeChunks> freeChunks;
+    constexpr static uint32_t MAX_FREE_CHUNKS = 8;
+
+    Queue<Chunk,InterruptSafeLock> zombies{};
 
     TCB* current() {
         auto was = Interrupts::disable();
@@ -30,12 +46,48 @@ namespace gheith {
         stop();
     }
 
-    void delete_zombies() {
-        while (true) {
-            auto it = zombies.remove();
-            if (it == nullptr) return;
-            delete it;
-        }
+    void* alloc_chunk() {
+        Chunk* out = nullptr;
+        Interrupts::protect([&out] {
+            auto& mine = freeChunks.mine();
+            if (mine.first != nullptr) {
+                out = mine.first;
+                mine.first = out->next;
+                mine.count --;
+            }
+        });
+        if (out != nullptr) return out;
+        return operator new(CHUNK_BYTES);
+    }
+
+    void enter_kernel() {
+        Interrupts::protect([] {
+            auto me = activeThreads[SMP::me()];
+            uint64_t now = rdtsc();
+            me->time.user += now - me->mark;
+            me->mark = now;
+        });
+    }
+
+    void leave_kernel() {
+        Interrupts::protect([] {
+            auto me = activeThreads[SMP::me()];
+            uint64_t now = rdtsc();
+            me->time.kernel += now - me->mark;
+            me->mark = now;
+        });
+    }
+
+    CpuTime cpu_time() {
+        CpuTime out;
+        Interrupts::protect([&out] {
+            auto me = activeThreads[SMP::me()];
+            uint64_t now = rdtsc();
+            me->time.kernel += now - me->mark;
+            me->mark = now;
+            out = me->time;
+        });
+        return out;
     }
 
     void schedule(TCB* tcb) {
@@ -55,9 +107,9 @@ namespace gheith {
 	InterruptSafeLock mutex{};
 	Condition cv{mutex};
     public:	
-	void put(TCB* tcb) {
+	void put(Chunk* chunk) {
 	    LockGuard g{mutex};
-	    zombies.add(tcb);
+	    zombies.add(chunk);
 	    cv.notifyOne();
 	}
 	void init() {
@@ -65,18 +117,33 @@ namespace gheith {
 	    new (&cv) Condition{mutex};
 	    thread([this] {
 		       Debug::printf("starting reaper\n");
-		       TCB* tcb;
+		       Chunk* chunk;
 		       while (true) {
 			   {
 			       LockGuard g{mutex};
-			       while (!(tcb = zombies.remove()))
+			       while (!(chunk = zombies.remove()))
 				   cv.wait();	    
 			   }
-			   delete tcb;
+			   operator delete(chunk);
 		       }
 		   });
 	}	
     } reaper;
+
+    // Called on the target stack, interrupts are disabled. The thread
+    // already gave up everything that can block (see stop)
+    static void recycle(TCB* tcb) {
+        tcb->~TCB();
+        auto chunk = (Chunk*) tcb;
+        auto& mine = freeChunks.mine();
+        if (mine.count < MAX_FREE_CHUNKS) {
+            chunk->next = mine.first;
+            mine.first = chunk;
+            mine.count ++;
+        } else {
+            reaper.put(chunk);
+        }
+    }
 };
 
 void threadsInit() {
@@ -92,6 +159,12 @@ void threadsInit() {
 
     // the reaper
     reaper.init();
+
+    // the worker pool
+    Workers::init();
+
+    // RCU callbacks
+    RCU::init();
 }
 
 void yield() {
@@ -104,10 +177,25 @@ void yield() {
 void stop() {
     using namespace gheith;
 
+    auto me = current();
+    if (!me->isIdle) {
+	// Once we're off our stack, interrupts are disabled and we can't
+	// touch the heap. Let go of everything while we still can
+	me->retire();
+	Shared<PCB> pcb{};
+	Interrupts::protect([me, &pcb] {
+	    pcb = (Shared<PCB>&&) me->pcb;
+	    me->pcb = kProc;
+	    // the address space could go away with the last reference
+	    setCR3(kProc->cr3);
+	});
+	pcb = nullptr;
+    }
+
     while(true) {
         block(BlockOption::MustBlock,[](TCB* me) {
             if (!me->isIdle) {
-		reaper.put(me);
+		recycle(me);
             }
         });
         ASSERT(current()->isIdle);
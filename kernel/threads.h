@@ -8,14 +8,19 @@
 #include "smp.h"
 #include "shared.h"
 #include "new.h"
+#include "libk.h"
 
+#include "machine.h"
 #include "tss.h"
 #include "pcb.h"
+#include "rcu.h"
 
 namespace gheith {
 
     constexpr static int STACK_BYTES = 8 * 1024;
     constexpr static int STACK_WORDS = STACK_BYTES / sizeof(uint32_t);
+    constexpr static int TCB_BYTES = 256;
+    constexpr static int CHUNK_BYTES = TCB_BYTES + STACK_BYTES;
 
     struct TCB;
 
@@ -39,23 +44,32 @@ namespace gheith {
         TCB* next;
         SaveArea saveArea;
 	Shared<PCB> pcb;
+
+	CpuTime time;
+	uint64_t mark;      // rdtsc when we last charged time to "time"
 	
         TCB(bool isIdle) :
 	    isIdle(isIdle),
-	    id(next_id.fetch_add(1)) {
+	    id(next_id.fetch_add(1)),
+	    mark(rdtsc()) {
             saveArea.tcb = this;
         }
 
 	TCB(Shared<PCB> pcb, bool isIdle) :
 	    isIdle(isIdle),
 	    id(next_id.fetch_add(1)),
-	    pcb(pcb) {
+	    pcb(K::move(pcb)),
+	    mark(rdtsc()) {
 	    saveArea.tcb = this;
 	}
 
         virtual ~TCB() {}
 
         virtual void doYourThing() = 0;
+
+        // Called by the thread on its way out (see stop). Gives up whatever
+        // doYourThing holds, it might never get a chance to return
+        virtual void retire() {}
     };
 
     extern "C" void gheith_contextSwitch(gheith::SaveArea *, gheith::SaveArea *, void* action, void* arg);
@@ -64,10 +78,16 @@ namespace gheith {
     extern TCB** idleThreads;
 
     extern TCB* current();
-    extern Queue<TCB,InterruptSafeLock> readyQ;
+    extern MPSCQueue<TCB,InterruptSafe<TicketLock>> readyQ;
     extern void entry();
     extern void schedule(TCB*);
-    extern void delete_zombies();
+
+    // CPU time accounting for the current thread. The kernel calls these
+    // on the way in from user mode and on the way back out
+    extern void enter_kernel();
+    extern void leave_kernel();
+    // Charges the time so far and returns the totals
+    extern CpuTime cpu_time();
 
     template <typename F>
     void caller(SaveArea* sa, F* f) {
@@ -98,6 +118,8 @@ namespace gheith {
             core_id = SMP::me();
             me = activeThreads[core_id];
             me->saveArea.no_preempt = 1;
+            // we're not in an RCU read section if we're willing to switch
+            RCU::quiescent();
         });
         
     again:
@@ -123,6 +145,15 @@ namespace gheith {
 
         next_tcb->saveArea.no_preempt = 1;
 
+	{
+	    // we've been running in the kernel, next has been waiting
+	    uint64_t now = rdtsc();
+	    me->time.kernel += now - me->mark;
+	    me->mark = now;
+	    next_tcb->time.wait += now - next_tcb->mark;
+	    next_tcb->mark = now;
+	}
+
         activeThreads[core_id] = next_tcb;  // Why is this safe?
 
 	{
@@ -137,9 +168,18 @@ namespace gheith {
         gheith_contextSwitch(&me->saveArea,&next_tcb->saveArea,(void *)caller<F>,(void*)&f);
     }
 
+    // A thread's TCB and its stack share one chunk of memory:
+    //
+    //     [ TCB (at most TCB_BYTES) | stack (STACK_BYTES) ]
+    //
+    // When a thread stops, its chunk goes on a per-core free list and the
+    // next thread() on that core builds its TCB in place. The reaper only
+    // sees the chunks that don't fit on the free list.
+    extern void* alloc_chunk();
+
     struct TCBWithStack : public TCB {
-        uint32_t *stack = new uint32_t[STACK_WORDS];
-    
+        uint32_t* const stack = (uint32_t*) ((uintptr_t) this + TCB_BYTES);
+
         TCBWithStack() : TCB(false) {
             stack[STACK_WORDS - 2] = 0x200;  // EFLAGS: IF
             stack[STACK_WORDS - 1] = (uint32_t) entry;
@@ -147,36 +187,46 @@ namespace gheith {
             saveArea.esp = (uint32_t) &stack[STACK_WORDS-2];
         }
 
-	TCBWithStack(Shared<PCB> pcb) : TCB(pcb, false) {
+	TCBWithStack(Shared<PCB> pcb) : TCB(K::move(pcb), false) {
 	    stack[STACK_WORDS - 2] = 0x200;  // EFLAGS: IF
             stack[STACK_WORDS - 1] = (uint32_t) entry;
 	        saveArea.no_preempt = 0;
             saveArea.esp = (uint32_t) &stack[STACK_WORDS-2];
-	    pcb->esp0 = saveArea.esp;
+	    this->pcb->esp0 = saveArea.esp;
 	}
-	
-        ~TCBWithStack() {
-            if (stack) {
-                delete[] stack;
-                stack = nullptr;
-            }
-        }
     };
     
 
     template <typename T>
     struct TCBImpl : public TCBWithStack {
-        T work;
+	// We control the lifetime of the work: it goes away as soon as
+	// the thread is done with it, not when the chunk is recycled
+	union { T work; };
+	bool alive = true;
 
-        TCBImpl(T work) : TCBWithStack(), work(work) {}
+        TCBImpl(T work) : TCBWithStack() {
+	    new (&this->work) T(work);
+	}
 	
-	TCBImpl(Shared<PCB> pcb, T work) : TCBWithStack(pcb), work(work) {}
+	TCBImpl(Shared<PCB> pcb, T work) : TCBWithStack(K::move(pcb)) {
+	    new (&this->work) T(work);
+	}
 	
-        ~TCBImpl() {}
+        ~TCBImpl() {
+	    retire();
+	}
 
         void doYourThing() override {
             work();
+	    retire();
         }
+
+	void retire() override {
+	    if (alive) {
+		alive = false;
+		work.~T();
+	    }
+	}
     };
 
     
@@ -189,23 +239,18 @@ extern void yield();
 
 
 template <typename T>
-void thread(T work) {
+void thread(Shared<PCB> pcb, T work) {
     using namespace gheith;
 
-    delete_zombies();
-    
-    auto tcb = new TCBImpl<T>(kProc, work);
+    static_assert(sizeof(TCBImpl<T>) <= TCB_BYTES, "thread closure is too big, capture less");
+
+    auto tcb = new (alloc_chunk()) TCBImpl<T>(K::move(pcb), work);
     schedule(tcb);
 }
 
 template <typename T>
-void thread(Shared<PCB> pcb, T work) {
-    using namespace gheith;
-
-    delete_zombies();
-
-    auto tcb = new TCBImpl<T>(pcb, work);
-    schedule(tcb);
+void thread(T work) {
+    thread(kProc, work);
 }
 
 
@@ -0,0 +1,174 @@
+#include "timer.h"
+#include "smp.h"
+#include "pit.h"
+#include "debug.h"
+#include "threads.h"
+
+class TimerWheel {
+    static constexpr uint32_t SHIFT = 6;
+    static constexpr uint32_t SLOTS = 1 << SHIFT;
+    static constexpr uint32_t MASK = SLOTS - 1;
+    static constexpr uint32_t LEVELS = 4;
+    static constexpr uint32_t MAX_DELTA = (1 << (SHIFT * LEVELS)) - 1;
+
+    Timer* slots[LEVELS][SLOTS];
+    uint32_t now = 0;             // the next tick to be processed
+
+    void link(Timer* t) {
+        uint32_t delta = t->expires - now;
+        if (delta > MAX_DELTA) {
+            // too far in the future, park it in the last level. It will be
+            // re-linked (and pushed back again if needed) when it cascades
+            t->expires = now + MAX_DELTA;
+            delta = MAX_DELTA;
+        }
+        uint32_t level = 0;
+        while (delta >= (uint32_t(1) << (SHIFT * (level + 1)))) level++;
+        auto head = &slots[level][(t->expires >> (SHIFT * level)) & MASK];
+        t->head = head;
+        t->prev = nullptr;
+        t->next = *head;
+        if (t->next) t->next->prev = t;
+        *head = t;
+    }
+
+    void unlink(Timer* t) {
+        if (t->prev) {
+            t->prev->next = t->next;
+        } else {
+            *t->head = t->next;
+        }
+        if (t->next) t->next->prev = t->prev;
+        t->next = nullptr;
+        t->prev = nullptr;
+        t->head = nullptr;
+    }
+
+public:
+    InterruptSafeLock lock{};     // cancel can come from other cores
+
+    TimerWheel() {
+        for (uint32_t l = 0; l < LEVELS; l++)
+            for (uint32_t s = 0; s < SLOTS; s++)
+                slots[l][s] = nullptr;
+    }
+
+    TimerWheel(const TimerWheel&) = delete;
+
+    void add(Timer* t, uint32_t ticks) {
+        LockGuard g{lock};
+        ASSERT(t->state == Timer::IDLE);
+        t->wheel = this;
+        // part of the current period is already gone, firing at "now" would
+        // be early. This way we wait for at least "ticks" full periods
+        t->expires = now + ticks;
+        t->state = Timer::ARMED;
+        link(t);
+    }
+
+    bool remove(Timer* t) {
+        LockGuard g{lock};
+        if (t->state != Timer::ARMED) return false;
+        unlink(t);
+        t->state = Timer::IDLE;
+        return true;
+    }
+
+    // Process one tick, returns the list of timers that are due. They are
+    // marked as FIRING and are no longer on the wheel
+    Timer* advance() {
+        LockGuard g{lock};
+
+        uint32_t index = now & MASK;
+        if (index == 0) {
+            // level 0 wrapped around, pull the next batch down from above
+            for (uint32_t level = 1; level < LEVELS; level++) {
+                uint32_t i = (now >> (SHIFT * level)) & MASK;
+                Timer* t = slots[level][i];
+                slots[level][i] = nullptr;
+                while (t) {
+                    auto next = t->next;
+                    link(t);
+                    t = next;
+                }
+                if (i != 0) break;
+            }
+        }
+
+        Timer* due = slots[0][index];
+        slots[0][index] = nullptr;
+        for (auto t = due; t != nullptr; t = t->next) {
+            t->head = nullptr;
+            t->state = Timer::FIRING;
+        }
+
+        now++;
+        return due;
+    }
+};
+
+static PerCPU<TimerWheel> wheels;
+
+namespace Timers {
+
+    void tick() {
+        ASSERT(Interrupts::isDisabled());
+        auto t = wheels.mine().advance();
+        // We call the handlers without holding the wheel lock. They are
+        // likely to grab other locks (semaphores, condition variables, ...)
+        // while the same locks are held when timers are armed
+        while (t) {
+            auto next = t->next;
+            t->next = nullptr;
+            t->prev = nullptr;
+            t->expired();
+            // the owner might free the timer as soon as it sees this
+            __atomic_store_n(&t->state, Timer::IDLE, __ATOMIC_SEQ_CST);
+            t = next;
+        }
+    }
+
+    void arm(Timer* timer, uint32_t ticks) {
+        if (ticks == 0) ticks = 1;
+        Interrupts::protect([timer, ticks] {
+            wheels.mine().add(timer, ticks);
+        });
+    }
+
+    bool cancel(Timer* timer) {
+        auto wheel = timer->wheel;
+        if (wheel == nullptr) return false;
+        bool out = wheel->remove(timer);
+        while (timer->state == Timer::FIRING) {
+            iAmStuckInALoop(false);
+        }
+        return out;
+    }
+}
+
+void sleep(uint64_t ns) {
+    using namespace gheith;
+
+    uint32_t ticks = Pit::nsToJiffies(ns);
+    if (ticks == 0) {
+        yield();
+        return;
+    }
+
+    TCB* volatile sleeper = nullptr;
+    auto wakeup = Timers::timer([&sleeper] {
+        schedule(sleeper);
+    });
+
+    block(BlockOption::MustBlock, [&sleeper, &wakeup, ticks](TCB* me) {
+        // idle threads have no business sleeping
+        ASSERT(!me->isIdle);
+        // We arm the timer from the target stack. This way it can't fire
+        // before we're safely off the core
+        sleeper = me;
+        Timers::arm(&wakeup, ticks);
+    });
+
+    // make sure expired() is done with our stack
+    Timers::cancel(&wakeup);
+}
@@ -0,0 +1,76 @@
+#ifndef _timer_h_
+#define _timer_h_
+
+#include "stdint.h"
+#include "atomic.h"
+
+// Per-core hierarchical timer wheels driven by the APIT interrupt
+//
+//    - every core owns a wheel and advances it by one tick on each of
+//      its own APIT interrupts
+//    - a timer is armed on the wheel of the core that arms it and fires
+//      on that core, from the interrupt handler, with interrupts disabled.
+//      expired() better be quick (schedule a thread, up a semaphore, ...)
+//    - a wheel has LEVELS levels of SLOTS slots. Level n has a resolution
+//      of SLOTS^n ticks and its timers cascade down to level n-1 whenever
+//      the levels below it wrap around. Arming and cancelling are O(1),
+//      a tick is O(1) plus the timers that cascade or fire
+//
+// A timer can't be reused or destroyed while it might be running. Always
+// call cancel before letting it go, cancel will wait for a running
+// expired() to finish.
+
+class TimerWheel;
+
+struct Timer {
+    enum State : uint32_t {
+        IDLE,
+        ARMED,
+        FIRING
+    };
+
+    Timer* next = nullptr;
+    Timer* prev = nullptr;
+    Timer** head = nullptr;        // the slot we live in
+    uint32_t expires = 0;          // in ticks of the owning wheel
+    TimerWheel* volatile wheel = nullptr;
+    volatile State state = IDLE;
+
+    // Called with interrupts disabled on the core that armed the timer
+    virtual void expired() = 0;
+};
+
+template <typename F>
+struct TimerImpl : public Timer {
+    F f;
+    TimerImpl(F f) : f(f) {}
+    void expired() override {
+        f();
+    }
+};
+
+namespace Timers {
+    // Called on every APIT interrupt, interrupts are disabled
+    void tick();
+
+    // Arm the timer to fire after the given number of ticks (at least one)
+    void arm(Timer* timer, uint32_t ticks);
+
+    // true  => the timer was armed and we removed it before it fired
+    // false => the timer already fired (or was never armed)
+    bool cancel(Timer* timer);
+
+    //
+    // auto t = Timers::timer([] { ... });
+    //
+    template <typename F>
+    TimerImpl<F> timer(F f) {
+        return TimerImpl<F>(f);
+    }
+}
+
+// Block the calling thread for (at least) the given number of nanoseconds.
+// The resolution is a jiffy (rounded up). A zero duration yields
+extern void sleep(uint64_t ns);
+
+#endif
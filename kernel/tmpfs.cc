@@ -0,0 +1,158 @@
+#include "tmpfs.h"
+#include "libk.h"
+#include "machine.h"
+
+static Atomic<uint32_t> nextNumber{1};
+static Atomic<uint32_t> pagesInUse{0};
+
+TmpNode::TmpNode(bool dir, Shared<Node> parent) :
+    Node(PhysMem::FRAME_SIZE, nextNumber.fetch_add(1)), parent(K::move(parent))
+{
+    mode = dir ? 0x41ed : 0x81a4;     // rwxr-xr-x, rw-r--r--
+    link_count = 1;
+    size = 0;
+    sectors = 0;
+    bzero(data, sizeof(data));
+}
+
+Shared<Node> TmpNode::root(Shared<Node> parent) {
+    return Shared<Node>{new TmpNode(true, K::move(parent))};
+}
+
+TmpNode::~TmpNode() {
+    for (uint32_t i = 0; i < nPages; i++) {
+        if (pages[i] != 0) {
+            PhysMem::decref(pages[i], [](uint32_t) {});
+            pagesInUse.add_fetch(-1);
+        }
+    }
+    delete[] pages;
+    while (children != nullptr) {
+        auto next = children->next;
+        delete[] children->name;
+        delete children;
+        children = next;
+    }
+}
+
+uint32_t TmpNode::page(uint32_t number, bool grow) {
+    if (number < nPages && pages[number] != 0) return pages[number];
+    if (!grow) return 0;
+
+    if (number >= nPages) {
+        // double the table
+        uint32_t n = (nPages == 0) ? 16 : 2 * nPages;
+        while (n <= number) n *= 2;
+        auto bigger = new uint32_t[n];
+        if (nPages != 0) memcpy(bigger, pages, nPages * sizeof(uint32_t));
+        bzero(&bigger[nPages], (n - nPages) * sizeof(uint32_t));
+        delete[] pages;
+        pages = bigger;
+        nPages = n;
+    }
+
+    if (pagesInUse.add_fetch(1) > MAX_PAGES) {
+        pagesInUse.add_fetch(-1);
+        return 0;
+    }
+    // comes zeroed
+    pages[number] = PhysMem::alloc_frame();
+    return pages[number];
+}
+
+void TmpNode::read_block(uint32_t number, char* buffer) {
+    read_part(number, 0, block_size, buffer);
+}
+
+void TmpNode::read_blocks(uint32_t first, uint32_t count, char* buffer) {
+    LockGuard g{lock};
+    for (uint32_t i = 0; i < count; i++) {
+        char* out = buffer + i * block_size;
+        uint32_t frame = page(first + i, false);
+        if (frame == 0) {
+            bzero(out, block_size);
+        } else {
+            memcpy(out, (char*) frame, block_size);
+        }
+    }
+}
+
+void TmpNode::read_part(uint32_t number, uint32_t offset, uint32_t n, char* buffer) {
+    ASSERT(offset + n <= block_size);
+    LockGuard g{lock};
+    uint32_t frame = page(number, false);
+    if (frame == 0) {
+        // a hole
+        bzero(buffer, n);
+    } else {
+        memcpy(buffer, (char*) frame + offset, n);
+    }
+}
+
+int32_t TmpNode::write(uint32_t offset, uint32_t n, const char* buffer) {
+    ASSERT(is_file());
+    if (offset + n < offset) return -1;
+
+    LockGuard g{lock};
+    uint32_t done = 0;
+    while (done < n) {
+        const uint32_t at = offset + done;
+        const uint32_t start = at % block_size;
+        uint32_t chunk = block_size - start;
+        if (chunk > n - done) chunk = n - done;
+
+        uint32_t frame = page(at / block_size, true);
+        // out of frames
+        if (frame == 0) break;
+        memcpy((char*) frame + start, &buffer[done], chunk);
+        done += chunk;
+    }
+    if (offset + done > size) size = offset + done;
+
+    if (done == 0) return (n == 0) ? 0 : -1;
+    return done;
+}
+
+Shared<Node> TmpNode::named(const char* name, uint32_t len) {
+    for (auto it = children; it != nullptr; it = it->next) {
+        if (it->len != len) continue;
+        uint32_t i = 0;
+        while (i < len && it->name[i] == name[i]) i++;
+        if (i == len) return it->node;
+    }
+    return Shared<Node>{};
+}
+
+Shared<Node> TmpNode::find_child(const char* name, uint32_t len) {
+    ASSERT(is_dir());
+    if (len == 1 && name[0] == '.') return Shared<Node>{this};
+    if (len == 2 && name[0] == '.' && name[1] == '.') return parent;
+
+    LockGuard g{lock};
+    return named(name, len);
+}
+
+Shared<Node> TmpNode::create_child(const char* name, uint32_t len) {
+    ASSERT(is_dir());
+    if (len == 0) return Shared<Node>{};
+    // "." and ".." are taken, and they aren't files
+    if (name[0] == '.' && (len == 1 || (len == 2 && name[1] == '.'))) return Shared<Node>{};
+
+    LockGuard g{lock};
+    auto existing = named(name, len);
+    if (existing != nullptr) return existing;
+
+    // files don't need "..", and a reference back would keep us both alive
+    auto it = new Child{new char[len], len, Shared<Node>{new TmpNode(false, Shared<Node>{})}, children};
+    memcpy(it->name, name, len);
+    children = it;
+    nChildren++;
+    return it->node;
+}
+
+uint32_t TmpNode::entry_count() {
+    ASSERT(is_dir());
+    LockGuard g{lock};
+    // "." and ".." are there too, like in ext2
+    return nChildren + 2;
+}
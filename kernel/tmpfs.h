@@ -0,0 +1,70 @@
+#ifndef _tmpfs_h_
+#define _tmpfs_h_
+
+#include "stdint.h"
+#include "ext2.h"
+#include "physmem.h"
+
+// Files that only live in memory (and are gone at shutdown)
+//
+//    - a file's data is a table of physical frames from PhysMem (the
+//      kernel sees them at their physical address). A frame shows up the
+//      first time something writes into it, holes read as zeros
+//    - a directory is a list of (name, node). There are no subdirectories
+//      yet, create_child() only makes files
+//    - all of them together get at most MAX_PAGES frames, past that
+//      writes come up short
+//    - mount the root with Ext2::mount("/tmp", TmpNode::root(...)) and
+//      paths through /tmp end up here
+//
+// One lock per node covers everything, it's memory speed either way.
+
+class TmpNode : public Node {
+
+    // file data
+    uint32_t* pages = nullptr;     // frames, 0 if not written yet
+    uint32_t nPages = 0;           // slots in "pages"
+
+    // directory entries
+    struct Child {
+        char* name;
+        uint32_t len;
+        Shared<Node> node;
+        Child* next;
+    };
+    Child* children = nullptr;
+    uint32_t nChildren = 0;
+    Shared<Node> parent;           // "..", null for files
+
+    // the child with that name, called with the lock held
+    Shared<Node> named(const char* name, uint32_t len);
+
+    // the frame for the given block, allocated if "grow" (0 if it isn't
+    // there or we're out of frames). Called with the lock held
+    uint32_t page(uint32_t number, bool grow);
+
+    TmpNode(bool dir, Shared<Node> parent);
+
+public:
+    static constexpr uint32_t MAX_PAGES = 1024;
+
+    // An empty tmpfs, ".." in its root is "parent"
+    static Shared<Node> root(Shared<Node> parent);
+
+    virtual ~TmpNode();
+
+    void read_block(uint32_t number, char* buffer) override;
+    void read_blocks(uint32_t first, uint32_t count, char* buffer) override;
+    void read_part(uint32_t number, uint32_t offset, uint32_t n, char* buffer) override;
+    int32_t write(uint32_t offset, uint32_t n, const char* buffer) override;
+
+    // nothing to read ahead, nothing to make durable
+    void readahead(uint32_t, uint32_t) override {}
+    void sync() override {}
+
+    Shared<Node> find_child(const char* name, uint32_t len) override;
+    Shared<Node> create_child(const char* name, uint32_t len) override;
+    uint32_t entry_count() override;
+};
+
+#endif
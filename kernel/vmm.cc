@@ -6,6 +6,8 @@
 
 #include "smp.h"
 #include "sys.h"
+#include "threads.h"
+#include "parallel.h"
 
 namespace VMM {
 
@@ -14,6 +16,7 @@ namespace VMM {
     
     constexpr uint32_t PAGES_PER_TABLE = 1024;
     constexpr uint32_t PAGE_BYTES = 4096;   
+    constexpr uint32_t PARALLEL_TABLES = 4;   // copy_pd() goes parallel from here
 
     namespace Flag {
 	constexpr uint32_t P	= 0x1;   // present
@@ -140,29 +143,43 @@ namespace VMM {
     uint32_t copy_pd(uint32_t* pd) {
 	using namespace PhysMem;
 	uint32_t* new_pd = (uint32_t*) alloc_frame();
-	for (uint32_t i = 0; i < PAGES_PER_TABLE; i++) {
+	auto copy = [pd, new_pd](uint32_t i) {
 	    uint32_t pde = pd[i];
 
 	    // no entry
 	    if (!(pde & Flag::P)) {
-		continue;
+		return;
 	    }
 
 	    // global page table
 	    if (!(pde & Flag::NG)) {
 		new_pd[i] = pde;
-		continue;
+		return;
 	    }
 
 	    // read-only page table
 	    if (!(pde & Flag::RW)) {
 		new_pd[i] = pde;
 		incref(pde & Flag::MASK);
-		continue;
+		return;
 	    }
 
 	    // non-global, read-write page table
 	    new_pd[i] = copy_pt((uint32_t*) (pde & Flag::MASK)) | (pde & 0xfff);
+	};
+
+	// Each page table we copy is up to 4MB of memcpy, a big address
+	// space gets them copied on every core. Small ones aren't worth
+	// waking anybody up for
+	constexpr uint32_t pFlag = Flag::NG | Flag::RW | Flag::P;
+	uint32_t tables = 0;
+	for (uint32_t i = 0; i < PAGES_PER_TABLE; i++) {
+	    if ((pd[i] & pFlag) == pFlag) tables++;
+	}
+	if (tables >= PARALLEL_TABLES) {
+	    parallel_for(0, PAGES_PER_TABLE, 4, copy);
+	} else {
+	    for (uint32_t i = 0; i < PAGES_PER_TABLE; i++) copy(i);
 	}
 	return (uint32_t) new_pd;
     }
@@ -284,6 +301,8 @@ extern "C" void vmm_pageFault(uintptr_t va_, uintptr_t *saveState) {
     // We need code to grab the current process so we can access its descriptors
     
     uint32_t error_code = saveState[8];
+    bool fromUser = (error_code & 0x4) != 0;
+    if (fromUser) gheith::enter_kernel();
     
     if (va_ == 0)
 	SYS::exit(-1);
@@ -305,4 +324,5 @@ extern "C" void vmm_pageFault(uintptr_t va_, uintptr_t *saveState) {
     } else {
 	map((uint32_t*) getCR3(), va_ & Flag::MASK, PhysMem::alloc_frame(), flags);
     }
+    if (fromUser) gheith::leave_kernel();
 }
@@ -0,0 +1,43 @@
+#include "workers.h"
+#include "smp.h"
+#include "config.h"
+#include "semaphore.h"
+#include "threads.h"
+
+namespace Workers {
+
+    static PerCPU<Queue<Job,InterruptSafeLock>> queues;
+    static Semaphore pending{0};     // jobs that haven't been claimed yet
+    static uint32_t nWorkers = 0;
+
+    // The semaphore guarantees that there is a job for us but not where
+    static Job* take(uint32_t mine) {
+        while (true) {
+            for (uint32_t i = 0; i < nWorkers; i++) {
+                auto job = queues.forCPU((mine + i) % nWorkers).remove();
+                if (job != nullptr) return job;
+            }
+            iAmStuckInALoop(false);
+        }
+    }
+
+    void post(Job* job) {
+        // we could move to another core right after this, it doesn't matter
+        queues.forCPU(SMP::me() % nWorkers).add(job);
+        pending.up();
+    }
+
+    void init() {
+        nWorkers = kConfig.totalProcs;
+        for (uint32_t i = 0; i < nWorkers; i++) {
+            thread([i] {
+                while (true) {
+                    pending.down();
+                    auto job = take(i);
+                    job->doYourThing();
+                    delete job;
+                }
+            });
+        }
+    }
+}
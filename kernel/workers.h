@@ -0,0 +1,47 @@
+#ifndef _workers_h_
+#define _workers_h_
+
+#include "atomic.h"
+#include "queue.h"
+
+// A fixed pool of kernel threads (one per core) for short jobs. Running a
+// job costs a queue operation instead of a TCB, a stack and a trip through
+// the reaper.
+//
+//    - a job is queued on the queue of the core that submits it
+//    - worker "i" drains queue "i" first then steals from the others
+//    - jobs are allowed to block but a job that waits for another job
+//      ties up a worker. Do that too many times and the pool deadlocks.
+//      Use thread() for long running or dependent work
+
+namespace Workers {
+
+    struct Job {
+        Job* next = nullptr;
+        virtual ~Job() {}
+        virtual void doYourThing() = 0;
+    };
+
+    template <typename T>
+    struct JobImpl : public Job {
+        T work;
+        JobImpl(T work) : work(work) {}
+        void doYourThing() override {
+            work();
+        }
+    };
+
+    // Called once, by threadsInit
+    extern void init();
+
+    extern void post(Job* job);
+
+    // Runs "work" on the pool. Fire and forget, see future.h if you need
+    // the result
+    template <typename T>
+    void execute(T work) {
+        post(new JobImpl<T>(work));
+    }
+}
+
+#endif
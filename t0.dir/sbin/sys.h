@@ -17,7 +17,9 @@ typedef unsigned int size_t;
 extern void exit(int rc);
 
 /* open */
-/* opens a file, returns file descriptor, flags is ignored */
+/* opens a file, returns file descriptor */
+/* with O_CREAT in flags, adds an empty file if there isn't one */
+#define O_CREAT 0x40
 extern int open(const char* fn, int flags);
 
 /* len */
@@ -58,6 +60,8 @@ extern int shutdown(void);
 /* wait */
 /* wait for a child, status filled with exit value from child */
 /* return 0 on success, -ve value on failure */
+/* id == WAIT_ANY: whichever child finishes first, returns its id */
+#define WAIT_ANY -1
 extern int wait(int id, uint32_t *status);
 
 /* seek */
@@ -78,4 +82,45 @@ extern int fork();
 /* a nullptr indicates end of arguments */
 extern int execl(const char* path, const char* arg0, ...);
 
+/* sleep */
+/* blocks the caller for at least 'ms' milliseconds */
+/* returns 0 */
+extern int sleep(uint32_t ms);
+
+/* rusage */
+/* who == RUSAGE_SELF: the calling process so far */
+/* who == RUSAGE_CHILDREN: the children it waited for (and theirs) */
+/* all times in microseconds */
+/* returns 0 on success, -1 on failure */
+#define RUSAGE_SELF 0
+#define RUSAGE_CHILDREN 1
+struct rusage {
+    uint64_t user;      /* running user code */
+    uint64_t kernel;    /* running in the kernel on its behalf */
+    uint64_t wait;      /* ready or blocked */
+};
+extern int rusage(int who, struct rusage* usage);
+
+/* cachestat */
+/* the kernel's disk block cache counters since boot */
+/* returns 0 on success, -1 on failure */
+struct cachestat {
+    uint32_t hits;      /* found in memory */
+    uint32_t misses;    /* read from the disk */
+    uint32_t evictions; /* dropped to make room */
+    uint32_t bytes;     /* cached right now */
+    uint32_t budget;    /* most it tries to keep */
+    uint32_t prefetched;     /* read ahead of sequential readers */
+    uint32_t prefetch_hits;  /* ... and then read by somebody */
+    uint32_t prefetch_waste; /* ... and evicted before anybody read them */
+    uint32_t dirty;     /* written, not on the disk yet */
+    uint32_t written;   /* blocks written back */
+};
+extern int cachestat(struct cachestat* stats);
+
+/* fsync */
+/* everything written to the file so far is on the disk when it returns */
+/* returns 0 on success, -1 on failure */
+extern int fsync(int fd);
+
 #endif
@@ -0,0 +1,43 @@
+#include "libc.h"
+
+/* sleep: returns 0, sleepers wake up in deadline order */
+
+int main(int argc, char** argv) {
+    printf("*** sleep(0) = %d\n",sleep(0));
+    printf("*** sleep(10) = %d\n",sleep(10));
+
+    /* they go to sleep in one order and wake up in another */
+    uint32_t ms[3] = { 300, 100, 200 };
+    int ids[3];
+    for (int i=0; i<3; i++) {
+        ids[i] = fork();
+        if (ids[i] < 0) {
+            printf("*** fork failed\n");
+        } else if (ids[i] == 0) {
+            int rc = sleep(ms[i]);
+            printf("*** slept %ldms, rc = %d\n",ms[i],rc);
+            exit(i);
+        }
+    }
+    printf("*** everybody is asleep\n");
+
+    for (int i=0; i<3; i++) {
+        uint32_t status = 42;
+        int rc = wait(ids[i],&status);
+        printf("*** wait = %d, status = %ld\n",rc,status);
+    }
+
+    /* the parent sleeps too, its child finishes first */
+    int id = fork();
+    if (id == 0) {
+        printf("*** child ran while the parent slept\n");
+        exit(0);
+    }
+    sleep(100);
+    printf("*** parent is up\n");
+    uint32_t status = 42;
+    wait(id,&status);
+
+    shutdown();
+    return 0;
+}
@@ -0,0 +1,74 @@
+#include "libc.h"
+
+/* rusage: its return values, and which times it counts */
+
+static void spin(void) {
+    for (volatile uint32_t i=0; i<10000000; i++);
+}
+
+static int zero(struct rusage* u) {
+    return u->user == 0 && u->kernel == 0 && u->wait == 0;
+}
+
+int main(int argc, char** argv) {
+    struct rusage before;
+    struct rusage after;
+
+    /* bad arguments */
+    printf("*** who = 2: %d\n",rusage(2,&before));
+    printf("*** who = -1: %d\n",rusage(-1,&before));
+    printf("*** kernel pointer: %d\n",rusage(RUSAGE_SELF,(struct rusage*) 0x1000));
+    printf("*** wrapping pointer: %d\n",rusage(RUSAGE_SELF,(struct rusage*) 0xfffffff8));
+
+    /* our own time only goes up */
+    printf("*** self: %d\n",rusage(RUSAGE_SELF,&before));
+    spin();
+    rusage(RUSAGE_SELF,&after);
+    printf("*** spinning counts as user time: %d\n",after.user > before.user);
+    rusage(RUSAGE_SELF,&before);
+    sleep(50);
+    rusage(RUSAGE_SELF,&after);
+    printf("*** sleeping counts as waiting: %d\n",after.wait > before.wait);
+
+    /* no children waited for yet */
+    printf("*** children: %d\n",rusage(RUSAGE_CHILDREN,&before));
+    printf("*** nothing yet: %d\n",zero(&before));
+
+    /* a child we don't wait for never shows up */
+    int id = fork();
+    if (id == 0) {
+        spin();
+        exit(0);
+    }
+    printf("*** close = %d\n",close(id));
+    sleep(100);
+    rusage(RUSAGE_CHILDREN,&after);
+    printf("*** still nothing: %d\n",zero(&after));
+
+    /* one we wait for does, with its own children */
+    id = fork();
+    if (id == 0) {
+        int id2 = fork();
+        if (id2 == 0) {
+            spin();
+            exit(0);
+        }
+        uint32_t status;
+        wait(id2,&status);
+        spin();
+        exit(0);
+    }
+    uint32_t status = 42;
+    printf("*** wait = %d\n",wait(id,&status));
+    rusage(RUSAGE_CHILDREN,&after);
+    printf("*** child counted: %d\n",after.user > 0);
+
+    /* and only once */
+    rusage(RUSAGE_CHILDREN,&before);
+    spin();
+    rusage(RUSAGE_CHILDREN,&after);
+    printf("*** not again: %d\n",after.user == before.user);
+
+    shutdown();
+    return 0;
+}
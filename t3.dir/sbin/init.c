@@ -0,0 +1,41 @@
+#include "libc.h"
+
+/* cachestat: its return values, and hits and misses as we read a file */
+
+int main(int argc, char** argv) {
+    struct cachestat a;
+    struct cachestat b;
+    struct cachestat c;
+
+    /* bad pointers */
+    printf("*** kernel pointer: %d\n",cachestat((struct cachestat*) 0x1000));
+    printf("*** wrapping pointer: %d\n",cachestat((struct cachestat*) 0xfffffff0));
+
+    printf("*** cachestat = %d\n",cachestat(&a));
+    printf("*** has a budget: %d\n",a.budget > 0);
+
+    int fd = open("/data/fox.txt",0);
+    char buf[100];
+
+    /* nobody read it yet, it comes from the disk */
+    cachestat(&a);
+    int n = read(fd,buf,100);
+    cachestat(&b);
+    printf("*** read %d bytes\n",n);
+    printf("*** missed: %d\n",b.misses > a.misses);
+    printf("*** cached: %d\n",b.bytes > 0);
+
+    /* the second time it's in memory */
+    seek(fd,0);
+    n = read(fd,buf,100);
+    cachestat(&c);
+    printf("*** read %d bytes\n",n);
+    printf("*** hit: %d\n",c.hits > b.hits);
+    printf("*** no more misses: %d\n",c.misses == b.misses);
+
+    /* the counters never go back */
+    printf("*** still counting: %d\n",c.hits >= a.hits && c.misses >= a.misses && c.evictions >= a.evictions);
+
+    shutdown();
+    return 0;
+}
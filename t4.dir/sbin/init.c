@@ -0,0 +1,69 @@
+#include "libc.h"
+
+/* open with O_CREAT, write and fsync: return values and error paths */
+
+#define BLOCK 4096
+#define BLOCKS 14     /* a couple past the direct ones */
+
+int main(int argc, char** argv) {
+    /* not there yet */
+    printf("*** open = %d\n",open("/new.txt",0));
+
+    int fd = open("/new.txt",O_CREAT);
+    printf("*** created: %d\n",fd >= 0);
+    printf("*** len = %d\n",len(fd));
+    printf("*** write = %d\n",write(fd,"hello, disk\n",12));
+    printf("*** len = %d\n",len(fd));
+
+    /* on the disk once fsync returns */
+    struct cachestat before;
+    struct cachestat after;
+    cachestat(&before);
+    printf("*** fsync = %d\n",fsync(fd));
+    cachestat(&after);
+    printf("*** written back: %d\n",after.written > before.written);
+    printf("*** nothing dirty: %d\n",after.dirty == 0);
+
+    /* only files can be synced */
+    printf("*** fsync(stdout) = %d\n",fsync(1));
+    printf("*** fsync(100) = %d\n",fsync(100));
+    printf("*** close = %d\n",close(fd));
+    printf("*** fsync(closed) = %d\n",fsync(fd));
+
+    /* O_CREAT on a file that's there opens it, it doesn't empty it */
+    fd = open("/new.txt",O_CREAT);
+    printf("*** len = %d\n",len(fd));
+    char buf[13];
+    int n = read(fd,buf,12);
+    buf[n < 0 ? 0 : n] = 0;
+    printf("*** read %d: %s",n,buf);
+    close(fd);
+    fd = open("/new.txt",0);
+    printf("*** len = %d\n",len(fd));
+    close(fd);
+
+    /* nothing to create */
+    printf("*** no directory: %d\n",open("/nowhere/new.txt",O_CREAT));
+    printf("*** a directory: %d\n",open("/sbin",O_CREAT));
+    printf("*** dot: %d\n",open("/sbin/.",O_CREAT));
+    printf("*** no name: %d\n",open("/",O_CREAT));
+
+    /* big enough to need an indirect block */
+    fd = open("/big.txt",O_CREAT);
+    char* block = malloc(BLOCK);
+    int ok = 1;
+    for (int i=0; i<BLOCKS; i++) {
+        memset(block,'a' + i,BLOCK);
+        if (write(fd,block,BLOCK) != BLOCK) ok = 0;
+    }
+    printf("*** wrote %d blocks: %d\n",BLOCKS,ok);
+    printf("*** fsync = %d\n",fsync(fd));
+    printf("*** len = %d\n",len(fd));
+    printf("*** seek = %ld\n",seek(fd,(BLOCKS-1)*BLOCK));
+    n = read(fd,buf,4);
+    buf[n < 0 ? 0 : n] = 0;
+    printf("*** last block: %s\n",buf);
+
+    shutdown();
+    return 0;
+}
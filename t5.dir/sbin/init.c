@@ -0,0 +1,64 @@
+#include "libc.h"
+
+/* files in /tmp: create, look up, write and read back whole blocks */
+
+#define BLOCK 4096
+
+/* how many bytes in [from,from+n) aren't "c" */
+static int wrong(const char* from, int n, char c) {
+    int count = 0;
+    for (int i=0; i<n; i++) {
+        if (from[i] != c) count++;
+    }
+    return count;
+}
+
+int main(int argc, char** argv) {
+    /* not there yet */
+    printf("*** open = %d\n",open("/tmp/data",0));
+
+    int fd = open("/tmp/data",O_CREAT);
+    printf("*** created: %d\n",fd >= 0);
+    printf("*** len = %d\n",len(fd));
+
+    /* two blocks, a hole of two more, and a few bytes past it */
+    char* block = malloc(BLOCK);
+    memset(block,'a',BLOCK);
+    printf("*** write = %d\n",write(fd,block,BLOCK));
+    memset(block,'b',BLOCK);
+    printf("*** write = %d\n",write(fd,block,BLOCK));
+    printf("*** seek = %ld\n",seek(fd,4*BLOCK));
+    printf("*** write = %d\n",write(fd,"end",3));
+    printf("*** len = %d\n",len(fd));
+    printf("*** close = %d\n",close(fd));
+
+    /* it's still there, and O_CREAT doesn't make another one */
+    fd = open("/tmp/data",0);
+    printf("*** found: %d\n",fd >= 0);
+    printf("*** len = %d\n",len(fd));
+    close(fd);
+    fd = open("/tmp/data",O_CREAT);
+    printf("*** len = %d\n",len(fd));
+
+    /* the first four blocks in one read */
+    char* all = malloc(4*BLOCK);
+    printf("*** read = %d\n",read(fd,all,4*BLOCK));
+    printf("*** block 0 wrong: %d\n",wrong(all,BLOCK,'a'));
+    printf("*** block 1 wrong: %d\n",wrong(all+BLOCK,BLOCK,'b'));
+    printf("*** hole wrong: %d\n",wrong(all+2*BLOCK,2*BLOCK,0));
+
+    /* and the rest */
+    char buf[8];
+    int n = read(fd,buf,sizeof(buf)-1);
+    buf[n < 0 ? 0 : n] = 0;
+    printf("*** read %d: %s\n",n,buf);
+    printf("*** read = %d\n",read(fd,buf,sizeof(buf)));
+    close(fd);
+
+    /* only in /tmp */
+    printf("*** on disk = %d\n",open("/data",0));
+    printf("*** other = %d\n",open("/tmp/other",0));
+
+    shutdown();
+    return 0;
+}
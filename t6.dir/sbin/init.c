@@ -0,0 +1,50 @@
+#include "libc.h"
+
+/* wait(WAIT_ANY): children come back in the order they finish */
+
+int main(int argc, char** argv) {
+    /* nobody to wait for */
+    uint32_t status = 42;
+    printf("*** wait = %d\n",wait(WAIT_ANY,&status));
+
+    uint32_t ms[3] = { 300, 100, 200 };
+    int ids[3];
+    for (int i=0; i<3; i++) {
+        ids[i] = fork();
+        if (ids[i] < 0) {
+            printf("*** fork failed\n");
+        } else if (ids[i] == 0) {
+            sleep(ms[i]);
+            exit(10 + i);
+        }
+    }
+
+    for (int i=0; i<3; i++) {
+        status = 42;
+        int id = wait(WAIT_ANY,&status);
+        int which = status - 10;
+        printf("*** status = %ld, right id: %d\n",status,
+            which >= 0 && which < 3 && id == ids[which]);
+        /* it's gone from the table */
+        printf("*** again = %d\n",wait(id,&status));
+    }
+
+    printf("*** wait = %d\n",wait(WAIT_ANY,&status));
+
+    /* one that's done already and one that isn't */
+    int slow = fork();
+    if (slow == 0) {
+        sleep(200);
+        exit(2);
+    }
+    int fast = fork();
+    if (fast == 0) exit(1);
+    sleep(100);
+    int id = wait(WAIT_ANY,&status);
+    printf("*** status = %ld, right id: %d\n",status,id == fast);
+    id = wait(WAIT_ANY,&status);
+    printf("*** status = %ld, right id: %d\n",status,id == slow);
+
+    shutdown();
+    return 0;
+}